@@ -5,12 +5,14 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-26 14:04:09 +0200
-// Last modified: 2026-01-17T21:51:29+0100
+// Last modified: 2026-10-24T14:31:50+0200
 
 #include "cairo-imgui.h"
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <cairo/cairo.h>
 #include <SDL3/SDL.h>
 #include "SDL3/SDL_events.h"
@@ -18,317 +20,1640 @@
 
 static double m_width, m_height;
 
-void gui_begin(SDL_Renderer *renderer, SDL_Texture *texture, GUI_context *out)
+#define FONT_SIZE 14.0
+
+// Widgets handle input when they are called, and add an item to the display
+// list. In gui_end, the list is compared with that of the previous frame,
+// and only the items in the damaged rectangles are drawn.
+enum {
+  ITEM_BUTTON,
+  ITEM_LABEL,
+  ITEM_CHECKBOX,
+  ITEM_RADIOBUTTONS,
+  ITEM_COLORSAMPLE,
+  ITEM_SLIDER,
+  ITEM_SPINNER,
+  ITEM_EDITBOX,
+  ITEM_PANEL,
+  ITEM_COLORWHEEL,
+  ITEM_LISTBOX,
+  ITEM_IMAGE,
+};
+
+static const char *kind_names[] = {
+  "button", "label", "checkbox", "radiobuttons", "colorsample", "slider",
+  "spinner", "editbox", "panel", "colorwheel", "listbox",
+  "image",
+};
+
+// Item flags.
+#define HOVER 1    // The mouse is inside, or the widget has the focus.
+#define PRESSED 2  // The mouse button is pressed.
+#define CHECKED 4
+
+// Room around a bounding box for line widths and antialiasing.
+#define MARGIN 2
+
+// The render thread draws a frame on the canvas while the main thread
+// handles events. Between gui_end and the signal of “done”, it owns the
+// display lists, the canvas and the cairo context and text cache; the main
+// thread waits for it in gui_begin. The main thread uploads and presents.
+struct GUI_render {
+  SDL_Thread *thread;
+  SDL_Semaphore *go;    // Signaled by gui_end.
+  SDL_Semaphore *done;  // Signaled by the render thread.
+  Uint32 event;         // Pushed by the render thread when it is done.
+  bool full;            // Redraw the whole canvas.
+  bool quit;
+};
+
+static void present(GUI_context *ctx);
+static void render_stop(GUI_context *c);
+
+// Damaged rectangles are painted in tiles of TILE×TILE pixels, by a pool of
+// ctx->workers threads and the thread that draws the frame.
+#define TILE 128
+
+struct GUI_worker {
+  struct GUI_pool *pool;
+  SDL_Thread *thread;
+  int32_t index;
+};
+
+struct GUI_pool {
+  struct GUI_worker workers[GUI_MAXWORKERS];
+  int32_t nthreads;
+  SDL_Semaphore *go;    // Signaled once for every worker.
+  SDL_Semaphore *done;  // Signaled by every worker.
+  SDL_Mutex *lock;      // Of the text cache.
+  SDL_AtomicInt next;   // Next tile to paint.
+  int32_t nrects;
+  int32_t first[GUI_MAXDAMAGE+1];  // First tile of each rectangle.
+  bool quit;
+  // Per thread, including the calling one.
+  unsigned char *canvas;  // That the surfaces were made for.
+  int32_t width, height;
+  cairo_surface_t *surface[GUI_MAXWORKERS+1];
+  cairo_t *cairo[GUI_MAXWORKERS+1];
+  GUI_context ctx[GUI_MAXWORKERS+1];
+};
+
+static void pool_stop(GUI_context *c);
+
+// Profiler for the HUD; allocated when the HUD is first shown.
+#define PROF_WINDOW 64  // Frames that are averaged.
+#define PROF_SLOTS 256  // Widgets that are timed, in the order of the calls.
+#define PROF_TOP 5      // Most expensive widgets that are shown.
+
+struct GUI_profile {
+  bool on;           // The HUD is shown in this frame.
+  int32_t frame;     // Index of this frame in the window.
+  int32_t nwidgets;  // Items in this frame that were made by widgets.
+  Uint64 begin;      // Start of this frame.
+  Uint64 event;      // Time of the oldest input that was not shown, or 0.
+  uint32_t frame_ns[PROF_WINDOW];
+  uint32_t latency_ns[PROF_WINDOW];
+  int32_t kind[PROF_SLOTS];
+  uint32_t widget_ns[PROF_SLOTS][PROF_WINDOW];  // Calls and painting.
+};
+
+// Only gui_begin changes “on”, so that the render thread sees the same
+// value during a frame.
+static inline bool prof_on(const GUI_context *c)
 {
-  assert(renderer);
-  assert(texture);
-  assert(out);
-  void *pixels;
-  int pitch;
-  int w, h;
-  out->renderer = renderer;
-  out->texture = texture;
-  SDL_GetCurrentRenderOutputSize(renderer, &w, &h);
-  // Create cairo surface which maps to the SDL texture.
-  SDL_LockTexture(texture, 0, &pixels, &pitch);
-  out->surface = cairo_image_surface_create_for_data(
-                   (char unsigned*)pixels, CAIRO_FORMAT_ARGB32, w, h, pitch);
-  // Create cairo context to draw on the surface.
-  out->ctx = cairo_create(out->surface);
-  // Set color to background, fill the surface)
-  cairo_set_source_rgb(out->ctx, out->bg.r, out->bg.g, out->bg.b);
-  cairo_paint(out->ctx);
-  // Set font size
-  cairo_set_font_size(out->ctx, 14.0);
-  // Determine the size of a capital M.
-  cairo_text_extents_t ext;
-  cairo_text_extents(out->ctx, "M", &ext);
-  m_width = ext.width;
-  m_height = ext.height;
-  out->counter = 1;
+  return c->prof != 0 && c->prof->on;
 }
 
-void gui_end(GUI_context *ctx)
+// Start a timer for a widget. Returns 0 if the HUD is off.
+static inline Uint64 prof_start(const GUI_context *c)
 {
-  assert(ctx);
-  ctx->button_released = false;
-  ctx->keycode = 0;
-  ctx->mod = 0;
-  // Clean up
-  cairo_destroy(ctx->ctx);
-  cairo_surface_destroy(ctx->surface);
-  ctx->surface = 0;
-  SDL_UnlockTexture(ctx->texture);
-  SDL_RenderTexture(ctx->renderer, ctx->texture, 0, 0);
-  SDL_RenderPresent(ctx->renderer);
-  ctx->maxid = ctx->counter;
+  return prof_on(c) ? SDL_GetTicksNS() : 0;
 }
 
-void gui_theme_light(GUI_context *ctx)
+// Add the time since “start” to item “slot” of the display list.
+static void prof_add(GUI_context *c, ptrdiff_t slot, Uint64 start)
 {
-  ctx->bg = (GUI_rgb) {
-    0.992157, 0.964706, 0.890196
-  }; // Base3 #fdf6e3
-  ctx->fg = (GUI_rgb) {
-    0.345098, 0.431373, 0.458824
-  }; // Base01 #586e75
-  ctx->acc = (GUI_rgb) {
-    0.14902, 0.545098, 0.823529
-  }; // Blue #268bd2
+  if (start == 0 || slot < 0 || slot >= PROF_SLOTS) {
+    return;
+  }
+  c->prof->kind[slot] = c->list[c->cur].items[slot].kind;
+  c->prof->widget_ns[slot][c->prof->frame] += SDL_GetTicksNS() - start;
 }
 
-void gui_theme_dark(GUI_context *ctx)
+// Stop the timer of the widget that made the last item.
+static void prof_stop(GUI_context *c, Uint64 start)
 {
-  ctx->bg = (GUI_rgb) {
-    0.027451, 0.211765, 0.258824
-  }; // Base02 #073642
-  ctx->fg = (GUI_rgb) {
-    0.576471, 0.631373, 0.631373
-  }; // Base1 #93a1a1
-  ctx->acc = (GUI_rgb) {
-    0.14902, 0.545098, 0.823529
-  }; // Blue #268bd2
+  prof_add(c, c->list[c->cur].nitems - 1, start);
 }
 
-SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event)
+// FNV-1a hash of “len” bytes.
+static uint64_t hash(uint64_t h, const void *data, size_t len)
 {
-  int w, h;
-  switch (event->type) {
-    case SDL_EVENT_WINDOW_RESIZED:
-      // Resize the texture if the window size changes.
-      SDL_DestroyTexture(ctx->texture);
-      SDL_GetWindowSize(SDL_GetRenderWindow(ctx->renderer), &w, &h);
-      ctx->texture = SDL_CreateTexture(ctx->renderer, SDL_PIXELFORMAT_ARGB8888,
-                                       SDL_TEXTUREACCESS_STREAMING, w, h);
-      break;
-    case SDL_EVENT_QUIT:
-      return SDL_APP_SUCCESS;
-      break;
-    case SDL_EVENT_KEY_DOWN:
-      if (event->key.key == 'q' || event->key.key == SDLK_ESCAPE) {
-        return SDL_APP_SUCCESS;
-      } else if (event->key.key == SDLK_TAB) {
-        if (event->key.mod & (SDL_KMOD_LSHIFT|SDL_KMOD_RSHIFT)) {
-          ctx->id--;
-          if (ctx->id < 0) {
-            ctx->id = ctx->maxid;
-          }
-        } else {
-          ctx->id++;
-          if (ctx->id > ctx->maxid) {
-            ctx->id = 1;
-          }
-        }
-      } else {
-        ctx->keycode = event->key.key;
-        ctx->mod = event->key.mod;
-      }
-      break;
-    case SDL_EVENT_MOUSE_MOTION:
-      ctx->mouse_x = event->motion.x;
-      ctx->mouse_y = event->motion.y;
-      break;
-    case SDL_EVENT_MOUSE_BUTTON_DOWN:
-      ctx->button_pressed = true;
-      ctx->button_released = false;
-      break;
-    case SDL_EVENT_MOUSE_BUTTON_UP:
-      ctx->button_pressed = false;
-      ctx->button_released = true;
-      break;
-    default:
-      if (ctx->button_released) {
-        ctx->button_released = false;
-      }
-      break;
+  const unsigned char *p = data;
+  for (size_t k = 0; k < len; k++) {
+    h = (h ^ p[k]) * 1099511628211u;
   }
-  return SDL_APP_CONTINUE;
+  return h;
 }
 
+// Add “len” bytes of text to the list. Returns the offset, or -1.
+static ptrdiff_t add_text(GUI_context *c, const char *text, ptrdiff_t len)
+{
+  GUI_list *l = &c->list[c->cur];
+  if (l->ntext + len > l->maxtext) {
+    ptrdiff_t max = l->maxtext ? l->maxtext : 1024;
+    while (max < l->ntext + len) {
+      max *= 2;
+    }
+    char *n = realloc(l->text, max);
+    if (n == 0) {
+      return -1;
+    }
+    l->text = n;
+    l->maxtext = max;
+    c->allocs++;
+  }
+  memcpy(l->text + l->ntext, text, len);
+  l->ntext += len;
+  return l->ntext - len;
+}
 
-bool gui_button(GUI_context *c, double x, double y, const char *label)
+// Add an item to the display list of this frame.
+// “text” contains “len” bytes, including terminating null(s).
+// Returns 0 if there is not enough memory.
+static GUI_item *record(GUI_context *c, int32_t kind, double x, double y,
+                        double w, double h, const char *text, ptrdiff_t len)
 {
-  assert(c);
-  // All interactive widgets should get an ID by increasing the counter.
-  int32_t id = c->counter++;
-  double rv = false;
-  double offset = 10.0;
-  cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, label, &ext);
-  double width = 2*offset + ext.width;
-  double height = 2*offset +ext.height;
-  // Draw button outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, width, height);
-  cairo_stroke(c->ctx);
-  // draw/Fill inside if mouse is inside, or we have the highlight.
-  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
-      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
-    c->id = id;
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+1, y+1, width-2, height-2);
-    if (c->button_pressed) {
-      cairo_fill(c->ctx);
-    } else {
-      cairo_stroke(c->ctx);
+  GUI_list *l = &c->list[c->cur];
+  if (l->nitems == l->maxitems) {
+    ptrdiff_t max = l->maxitems ? 2 * l->maxitems : 64;
+    GUI_item *n = realloc(l->items, max * sizeof(GUI_item));
+    if (n == 0) {
+      return 0;
     }
-    if (c->button_released || c->keycode == SDLK_RETURN) {
-      rv = true;
+    l->items = n;
+    l->maxitems = max;
+    c->allocs++;
+  }
+  GUI_item *it = &l->items[l->nitems];
+  memset(it, 0, sizeof(GUI_item));
+  it->kind = kind;
+  it->x = x;
+  it->y = y;
+  it->w = w;
+  it->h = h;
+  it->text = -1;
+  if (text != 0) {
+    it->text = add_text(c, text, len);
+    if (it->text < 0) {
+      return 0;
     }
   }
-  // Draw the label
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_move_to(c->ctx, x + offset, y+offset+ext.height);
-  cairo_show_text(c->ctx, label);
-  cairo_fill(c->ctx);
-  return rv;
+  l->nitems++;
+  return it;
 }
 
-void gui_label(GUI_context *c, double x, double y, const char *label)
+// Compute the hash of a completed item.
+static void seal(GUI_context *c, GUI_item *it)
 {
-  assert(c);
-  // Labels don't interact, so they have no id.
-  cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, label, &ext);
-  // Draw the label
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_move_to(c->ctx, x, y+ext.height);
-  cairo_show_text(c->ctx, label);
-  cairo_fill(c->ctx);
+  if (it == 0) {
+    return;
+  }
+  uint64_t h = 14695981039346656037u;
+  h = hash(h, &it->kind, sizeof(it->kind));
+  h = hash(h, &it->flags, sizeof(it->flags));
+  h = hash(h, &it->x, 4 * sizeof(double));
+  h = hash(h, it->v, sizeof(it->v));
+  if (it->text >= 0) {
+    const char *text = c->list[c->cur].text + it->text;
+    ptrdiff_t len = c->list[c->cur].ntext - it->text;
+    h = hash(h, text, len);
+  }
+  it->hash = h;
 }
 
-bool gui_checkbox(GUI_context *c, double x, double y, const char *label, bool *state)
+// Grow the box x0, y0, x1, y1 to contain text with extents “ext”, drawn
+// at x, y.
+static void text_box(double box[4], double x, double y,
+                     const cairo_text_extents_t *ext)
 {
-  assert(c);
-  int32_t id = c->counter++;
-  double rv = false;
-  double offset = 5.0;
-  double boxsize = m_width>m_height?m_width:m_height;
-  cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, label, &ext);
-  double width = 2*offset + ext.width + boxsize;
-  double height = 2*offset + ext.height>boxsize?ext.height:boxsize;
-  // Draw checkbox outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, boxsize, boxsize);
-  cairo_stroke(c->ctx);
-  // draw/Fill inside if mouse is inside, or we have the highlight.
-  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
-      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
-    c->id = id;
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+1, y+1, boxsize-2, boxsize-2);
-    if (c->button_pressed) {
-      cairo_fill(c->ctx);
-    } else {
-      cairo_stroke(c->ctx);
+  double tx = x + ext->x_bearing;
+  double ty = y + ext->y_bearing;
+  box[0] = fmin(box[0], tx);
+  box[1] = fmin(box[1], ty);
+  box[2] = fmax(box[2], tx + ext->width);
+  box[3] = fmax(box[3], ty + ext->height);
+}
+
+// Add a rectangle to the damaged area of the canvas.
+static void damage(GUI_context *c, double x, double y, double w, double h)
+{
+  int x0 = fmax(floor(x) - MARGIN, 0);
+  int y0 = fmax(floor(y) - MARGIN, 0);
+  int x1 = fmin(ceil(x + w) + MARGIN, c->width);
+  int y1 = fmin(ceil(y + h) + MARGIN, c->height);
+  if (x1 <= x0 || y1 <= y0) {
+    return;
+  }
+  // Take in the rectangles that overlap. The union can overlap others, so
+  // look again until none do; tiles of different rectangles must not
+  // overlap, since they can be painted at the same time.
+  for (int k = 0; k < c->ndamage; k++) {
+    SDL_Rect *d = &c->damage[k];
+    if (x0 < d->x + d->w && d->x < x1 && y0 < d->y + d->h && d->y < y1) {
+      x0 = d->x < x0 ? d->x : x0;
+      y0 = d->y < y0 ? d->y : y0;
+      x1 = d->x + d->w > x1 ? d->x + d->w : x1;
+      y1 = d->y + d->h > y1 ? d->y + d->h : y1;
+      *d = c->damage[--c->ndamage];
+      k = -1;
     }
-    if (c->button_released || c->keycode == SDLK_RETURN) {
-      rv = true;
-      *state = !*state;
+  }
+  SDL_Rect r = {x0, y0, x1 - x0, y1 - y0};
+  if (c->ndamage == GUI_MAXDAMAGE) {
+    // Too many; redraw the area that contains all of them.
+    for (int k = 0; k < c->ndamage; k++) {
+      SDL_Rect *d = &c->damage[k];
+      x0 = d->x < x0 ? d->x : x0;
+      y0 = d->y < y0 ? d->y : y0;
+      x1 = d->x + d->w > x1 ? d->x + d->w : x1;
+      y1 = d->y + d->h > y1 ? d->y + d->h : y1;
     }
+    c->damage[0] = (SDL_Rect) {x0, y0, x1 - x0, y1 - y0};
+    c->ndamage = 1;
+    return;
   }
-  // Draw selected mark if needed.
-  if (*state) {
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-    cairo_move_to(c->ctx, x, y);
-    cairo_rel_line_to(c->ctx, boxsize, boxsize);
-    cairo_rel_move_to(c->ctx, 0, -boxsize);
-    cairo_rel_line_to(c->ctx, -boxsize, boxsize);
-    cairo_stroke(c->ctx);
+  c->damage[c->ndamage++] = r;
+}
+
+static uint64_t theme_hash(const GUI_context *c)
+{
+  uint64_t h = 14695981039346656037u;
+  h = hash(h, &c->fg, sizeof(GUI_rgb));
+  h = hash(h, &c->bg, sizeof(GUI_rgb));
+  return hash(h, &c->acc, sizeof(GUI_rgb));
+}
+
+// Count an allocation. While painting, possibly in the render thread, it
+// is kept apart; see present.
+static void count_alloc(GUI_context *c)
+{
+  if (c->painting) {
+    c->paint_allocs++;
+  } else {
+    c->allocs++;
   }
-  // Draw the label
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_move_to(c->ctx, x + boxsize + offset, y+boxsize/2+ext.height/2);
-  cairo_show_text(c->ctx, label);
-  cairo_fill(c->ctx);
-  return rv;
 }
 
-bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
-                      const char *labels[nlabels], int *state)
+// Cache of text extents and glyphs, so that text is laid out only once.
+// It is set-associative, with LRU replacement within a set, so its size is
+// fixed. Longer texts are not cached.
+#define TEXT_SETS 32
+#define TEXT_WAYS 4
+#define TEXT_LEN 48  // Including the terminating null.
+
+typedef struct {
+  uint64_t hash;
+  cairo_font_face_t *font;
+  double size;
+  uint32_t used;  // Clock of the last lookup; 0 if empty.
+  int32_t nglyphs;
+  char text[TEXT_LEN];
+  cairo_text_extents_t ext;
+  cairo_glyph_t glyphs[TEXT_LEN];
+} Text_entry;
+
+struct GUI_textcache {
+  uint32_t clock;
+  Text_entry sets[TEXT_SETS][TEXT_WAYS];
+};
+
+// Color wheels; the discs are cached per diameter, least recently used
+// first out.
+#define WHEEL_CACHE 4
+#define WHEEL_PAD 6.0  // Around the disc, for the markers.
+#define WHEEL_BAR 16.0 // Width of the value bar.
+
+struct GUI_wheels {
+  uint32_t clock;
+  struct {
+    int32_t size;
+    uint32_t used;
+    cairo_surface_t *disc;
+  } e[WHEEL_CACHE];
+};
+
+// Images, decoded from PNG files and scaled; see gui_image. The least
+// recently used are dropped first when there are more than IMAGE_CACHE, or
+// when they take more than ctx->image_limit bytes. Images that are shown in
+// the current frame are kept, so the limit can be exceeded for a frame.
+#define IMAGE_CACHE 64
+
+typedef struct {
+  uint64_t key;     // Hash of the path.
+  char *path;       // Or 0 if the entry is free.
+  int32_t w, h;     // Of the surface.
+  int32_t nw, nh;   // Of the file; 0 if it could not be read.
+  uint32_t used;    // Clock of the last use.
+  uint32_t frame;   // Frame of the last use.
+  uint32_t serial;  // Changes when the file is read again.
+  bool stale;       // Forgotten; dropped when no longer shown.
+  ptrdiff_t bytes;
+  cairo_surface_t *surface;
+} Image_entry;
+
+struct GUI_images {
+  uint32_t clock, frame, serial;
+  ptrdiff_t bytes;
+  Image_entry e[IMAGE_CACHE];
+};
+
+// Streaming textures, by size rounded up to TEXTURE_BUCKET pixels; least
+// recently used first out.
+#define TEXTURE_POOL 3
+#define TEXTURE_BUCKET 256
+
+struct GUI_textures {
+  uint32_t clock;
+  struct {
+    int32_t w, h;
+    uint32_t used;
+    SDL_Texture *texture;
+  } e[TEXTURE_POOL];
+};
+
+// Find “text” in the cache, or lay it out and add it.
+// Returns 0 if it cannot be cached.
+static const Text_entry *text_lookup(GUI_context *c, const char *text)
 {
-  assert(c);
-  assert(labels);
-  assert(nlabels > 0);
-  int32_t id = c->counter++;
-  double rv = false;
-  double offset = 5.0;
-  //double boxsize = 14.0;
-  double boxsize = (m_width>m_height?m_width:m_height)*1.5;
-  double width, height;
-  double heights[nlabels];
-  double exty[nlabels];
-  cairo_text_extents_t ext = {0};
-  cairo_text_extents(c->ctx, labels[0], &ext);
-  width = ext.width;
-  height = ext.height;
-  heights[0] = ext.height>boxsize?ext.height:boxsize;
-  exty[0] = ext.height;
-  for (int k = 1; k < nlabels; k++) {
-    cairo_text_extents(c->ctx, labels[k], &ext);
-    heights[k] = ext.height>boxsize?ext.height:boxsize;
-    exty[k] = ext.height;
-    if (width < ext.width) {
-      width = ext.width;
+  size_t len = strlen(text);
+  if (len >= TEXT_LEN) {
+    return 0;
+  }
+  if (c->texts == 0) {
+    if (c->textlock != 0) { // Painting tiles; the cache is not shared yet.
+      return 0;
+    }
+    c->texts = calloc(1, sizeof(struct GUI_textcache));
+    count_alloc(c);
+    if (c->texts == 0) {
+      return 0;
     }
-    height += heights[k];
   }
-  width += 2*offset + boxsize;
-  height += 2*offset;
-  // Draw the buttons.
-  int cury = y + boxsize/2;
-  int curx = x + boxsize/2;
-  // Draw the buttons and the selected one
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  for (int k = 0; k < nlabels; k++) {
-    cairo_new_path(c->ctx);
-    cairo_arc(c->ctx, curx, cury, boxsize/2 - 2, 0.0, 2*M_PI);
-    cairo_stroke(c->ctx);
-    if (*state == k) {
-      cairo_new_path(c->ctx);
-      cairo_arc(c->ctx, curx, cury, boxsize/2 - 4, 0.0, 2*M_PI);
-      cairo_fill(c->ctx);
+  if (++c->texts->clock == 0) { // Wrapped around; start over.
+    memset(c->texts, 0, sizeof(struct GUI_textcache));
+    c->texts->clock = 1;
+  }
+  uint64_t h = hash(14695981039346656037u, text, len);
+  h = hash(h, &c->font, sizeof(c->font));
+  Text_entry *set = c->texts->sets[h % TEXT_SETS];
+  Text_entry *victim = &set[0];
+  for (int k = 0; k < TEXT_WAYS; k++) {
+    Text_entry *e = &set[k];
+    if (e->used != 0 && e->hash == h && e->font == c->font &&
+        e->size == FONT_SIZE && strcmp(e->text, text) == 0) {
+      e->used = c->texts->clock;
+      return e;
+    }
+    if (e->used < victim->used) {
+      victim = e;
     }
-    cury += heights[k];
   }
-  // Draw the labels
-  cury = y + offset;
-  curx = x + boxsize + offset;
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  for (int k = 0; k < nlabels; k++) {
-    cairo_move_to(c->ctx, curx, cury+exty[k]/2);
-    cairo_show_text(c->ctx, labels[k]);
-    cury += heights[k];
+  // Not found; replace the least recently used entry. The glyphs are laid
+  // out in the entry, so nothing is allocated if they fit.
+  cairo_glyph_t *glyphs = victim->glyphs;
+  int nglyphs = TEXT_LEN;
+  victim->used = 0;
+  cairo_status_t status = cairo_scaled_font_text_to_glyphs(
+                            cairo_get_scaled_font(c->ctx), 0, 0, text, len,
+                            &glyphs, &nglyphs, 0, 0, 0);
+  if (glyphs != victim->glyphs) { // More glyphs than fit in the entry.
+    // Counted by the caller, which then lays out the text without the cache.
+    cairo_glyph_free(glyphs);
+    return 0;
   }
-  cairo_fill(c->ctx);
-  // draw/Fill inside if mouse is inside, or we have the highlight.
-  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
-      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
-    c->id = id;
+  if (status != CAIRO_STATUS_SUCCESS) {
+    return 0;
+  }
+  cairo_glyph_extents(c->ctx, victim->glyphs, nglyphs, &victim->ext);
+  victim->hash = h;
+  victim->font = c->font;
+  victim->size = FONT_SIZE;
+  victim->used = c->texts->clock;
+  victim->nglyphs = nglyphs;
+  memcpy(victim->text, text, len + 1);
+  return victim;
+}
+
+static void text_extents(GUI_context *c, const char *text,
+                         cairo_text_extents_t *ext)
+{
+  if (c->textlock != 0) {
+    SDL_LockMutex(c->textlock);
+  }
+  const Text_entry *e = text_lookup(c, text);
+  if (e != 0) {
+    *ext = e->ext;
+  }
+  if (c->textlock != 0) {
+    SDL_UnlockMutex(c->textlock);
+  }
+  if (e == 0) {
+    cairo_text_extents(c->ctx, text, ext);
+    count_alloc(c);
+  }
+}
+
+// Draw “text” with its origin at x, y.
+static void show_text(GUI_context *c, double x, double y, const char *text)
+{
+  cairo_glyph_t glyphs[TEXT_LEN];
+  int nglyphs = -1;
+  if (c->textlock != 0) {
+    SDL_LockMutex(c->textlock);
+  }
+  const Text_entry *e = text_lookup(c, text);
+  if (e != 0) {
+    nglyphs = e->nglyphs;
+    for (int k = 0; k < nglyphs; k++) {
+      glyphs[k].index = e->glyphs[k].index;
+      glyphs[k].x = e->glyphs[k].x + x;
+      glyphs[k].y = e->glyphs[k].y + y;
+    }
+  }
+  if (c->textlock != 0) {
+    SDL_UnlockMutex(c->textlock);
+  }
+  if (nglyphs < 0) {
+    cairo_move_to(c->ctx, x, y);
+    cairo_show_text(c->ctx, text);
+    count_alloc(c);
+    return;
+  }
+  cairo_show_glyphs(c->ctx, glyphs, nglyphs);
+}
+
+// Start a frame of w×h pixels.
+static void begin(GUI_context *out, int32_t w, int32_t h)
+{
+  out->allocs = 0;
+  // The render thread must be done with the previous frame.
+  if (out->pending) {
+    SDL_WaitSemaphore(out->render->done);
+    out->pending = false;
+    present(out);
+  }
+  if (out->hud && out->prof == 0) {
+    out->prof = calloc(1, sizeof(struct GUI_profile));
+    out->allocs++;
+  }
+  if (out->prof != 0) {
+    out->prof->on = out->hud;
+  }
+  if (prof_on(out)) {
+    struct GUI_profile *p = out->prof;
+    p->begin = SDL_GetTicksNS();
+    p->frame = (p->frame + 1) % PROF_WINDOW;
+    for (int k = 0; k < PROF_SLOTS; k++) {
+      p->widget_ns[k][p->frame] = 0;
+    }
+  }
+  // The canvas, and the cairo surface and context that draw on it, are kept
+  // between frames. They are only replaced when the size changes.
+  if (out->ctx == 0 || out->width != w || out->height != h) {
+    if (out->ctx != 0) {
+      cairo_destroy(out->ctx);
+      cairo_surface_destroy(out->surface);
+    }
+    out->width = w;
+    out->height = h;
+    out->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
+    // Room for a canvas up to the next texture bucket, so that resizing
+    // the window rarely reallocates it.
+    if ((ptrdiff_t)h * out->stride > out->canvas_size) {
+      int32_t bw = (w + TEXTURE_BUCKET - 1) / TEXTURE_BUCKET * TEXTURE_BUCKET;
+      int32_t bh = (h + TEXTURE_BUCKET - 1) / TEXTURE_BUCKET * TEXTURE_BUCKET;
+      free(out->canvas);
+      out->canvas_size = (ptrdiff_t)bh *
+                         cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, bw);
+      out->canvas = calloc(1, out->canvas_size);
+      out->allocs++;
+      if (out->canvas == 0) {
+        out->canvas_size = 0;
+      }
+    }
+    if (out->canvas == 0) {
+      out->width = out->height = 0;
+    }
+    out->surface = cairo_image_surface_create_for_data(
+                     out->canvas, CAIRO_FORMAT_ARGB32, out->width, out->height,
+                     out->stride);
+    out->ctx = cairo_create(out->surface);
+    cairo_set_font_size(out->ctx, FONT_SIZE);
+    out->allocs += 2;
+    out->full = true;
+  }
+  // Keep a reference to the font, so that it is not replaced by another
+  // one at the same address while it is used in the text cache.
+  cairo_font_face_t *font = cairo_get_font_face(out->ctx);
+  if (font != out->font) {
+    if (out->font != 0) {
+      cairo_font_face_destroy(out->font);
+    }
+    out->font = cairo_font_face_reference(font);
+    if (out->texts != 0) {
+      memset(out->texts, 0, sizeof(struct GUI_textcache));
+    }
+  }
+  // Widgets may change the state of the context; undone in gui_end.
+  cairo_save(out->ctx);
+  // Determine the size of a capital M.
+  cairo_text_extents_t ext;
+  text_extents(out, "M", &ext);
+  m_width = ext.width;
+  m_height = ext.height;
+  out->counter = 1;
+  out->editing = false;
+  out->dirty = false;
+  if (out->images != 0) {
+    out->images->frame++;
+  }
+  // Start a new display list.
+  out->cur ^= 1;
+  out->list[out->cur].nitems = 0;
+  out->list[out->cur].ntext = 0;
+}
+
+// Find a texture of at least w×h pixels in the pool, or create one.
+// Sizes are rounded up to buckets, so that a window that is resized back and
+// forth reuses the textures it had. Returns 0 on failure.
+static SDL_Texture *pool_texture(GUI_context *c, int32_t w, int32_t h)
+{
+  if (c->textures == 0) {
+    c->textures = calloc(1, sizeof(struct GUI_textures));
+    c->allocs++;
+    if (c->textures == 0) {
+      return 0;
+    }
+  }
+  struct GUI_textures *p = c->textures;
+  w = (w + TEXTURE_BUCKET - 1) / TEXTURE_BUCKET * TEXTURE_BUCKET;
+  h = (h + TEXTURE_BUCKET - 1) / TEXTURE_BUCKET * TEXTURE_BUCKET;
+  p->clock++;
+  int victim = 0;
+  for (int k = 0; k < TEXTURE_POOL; k++) {
+    if (p->e[k].texture != 0 && p->e[k].w == w && p->e[k].h == h) {
+      p->e[k].used = p->clock;
+      return p->e[k].texture;
+    }
+    if (p->e[k].used < p->e[victim].used) {
+      victim = k;
+    }
+  }
+  if (p->e[victim].texture != 0) {
+    SDL_DestroyTexture(p->e[victim].texture);
+  }
+  p->e[victim].texture = SDL_CreateTexture(c->renderer,
+                                           SDL_PIXELFORMAT_ARGB8888,
+                                           SDL_TEXTUREACCESS_STREAMING, w, h);
+  p->e[victim].w = w;
+  p->e[victim].h = h;
+  p->e[victim].used = p->clock;
+  c->allocs++;
+  return p->e[victim].texture;
+}
+
+void gui_begin(SDL_Renderer *renderer, GUI_context *out)
+{
+  assert(renderer);
+  assert(out);
+  int w = out->width, h = out->height;
+  out->renderer = renderer;
+  // Resize events are coalesced; only the last size counts.
+  if (out->texture == 0 || out->resized) {
+    SDL_GetWindowSize(SDL_GetRenderWindow(renderer), &w, &h);
+    out->resized = false;
+  }
+  begin(out, w, h);
+  // After begin, since it presents a frame that the render thread drew.
+  out->texture = pool_texture(out, out->width, out->height);
+}
+
+void gui_begin_offscreen(int32_t width, int32_t height, GUI_context *out)
+{
+  assert(width > 0 && height > 0);
+  assert(out);
+  out->renderer = 0;
+  out->texture = 0;
+  begin(out, width, height);
+}
+
+static void paint_item(GUI_context *c, const GUI_item *it, const char *text);
+
+// Paint the items in rectangle “r”.
+static void paint_rect(GUI_context *c, const SDL_Rect *r)
+{
+  const GUI_list *now = &c->list[c->cur];
+  cairo_save(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, r->x, r->y, r->w, r->h);
+  cairo_clip(c->ctx);
+  // Set color to background, fill the damaged area.
+  cairo_set_source_rgb(c->ctx, c->bg.r, c->bg.g, c->bg.b);
+  cairo_paint(c->ctx);
+  for (ptrdiff_t j = 0; j < now->nitems; j++) {
+    const GUI_item *it = &now->items[j];
+    if (it->x - MARGIN < r->x + r->w && r->x < it->x + it->w + MARGIN &&
+        it->y - MARGIN < r->y + r->h && r->y < it->y + it->h + MARGIN) {
+      Uint64 start = prof_start(c);
+      paint_item(c, it, it->text >= 0 ? now->text + it->text : 0);
+      if (start != 0 && j < c->prof->nwidgets) {
+        prof_add(c, j, start);
+      }
+    }
+  }
+  cairo_restore(c->ctx);
+}
+
+// Paint tiles until there are none left.
+static void paint_worker(struct GUI_pool *p, int32_t w)
+{
+  GUI_context *c = &p->ctx[w];
+  int32_t job;
+  while ((job = SDL_AddAtomicInt(&p->next, 1)) < p->first[p->nrects]) {
+    int32_t k = 0;
+    while (job >= p->first[k+1]) {
+      k++;
+    }
+    // Tiles are numbered by row in each damaged rectangle.
+    const SDL_Rect *r = &c->damage[k];
+    int32_t cols = (r->w + TILE - 1) / TILE;
+    int32_t tx = (job - p->first[k]) % cols * TILE;
+    int32_t ty = (job - p->first[k]) / cols * TILE;
+    SDL_Rect tile = {
+      r->x + tx, r->y + ty, SDL_min(TILE, r->w - tx), SDL_min(TILE, r->h - ty)
+    };
+    paint_rect(c, &tile);
+  }
+}
+
+static int pool_thread(void *data)
+{
+  struct GUI_worker *w = data;
+  for (;;) {
+    SDL_WaitSemaphore(w->pool->go);
+    if (w->pool->quit) {
+      return 0;
+    }
+    paint_worker(w->pool, w->index);
+    SDL_SignalSemaphore(w->pool->done);
+  }
+}
+
+// Start the worker pool. Returns false if that is not possible.
+static bool pool_start(GUI_context *c)
+{
+  struct GUI_pool *p = calloc(1, sizeof(struct GUI_pool));
+  count_alloc(c);
+  if (p == 0) {
+    return false;
+  }
+  c->pool = p;
+  p->go = SDL_CreateSemaphore(0);
+  p->done = SDL_CreateSemaphore(0);
+  p->lock = SDL_CreateMutex();
+  if (p->go == 0 || p->done == 0 || p->lock == 0) {
+    pool_stop(c);
+    return false;
+  }
+  int32_t n = SDL_min(c->workers, GUI_MAXWORKERS);
+  for (; p->nthreads < n; p->nthreads++) {
+    struct GUI_worker *w = &p->workers[p->nthreads];
+    w->pool = p;
+    w->index = p->nthreads + 1;  // Worker 0 is the calling thread.
+    w->thread = SDL_CreateThread(pool_thread, "paint", w);
+    if (w->thread == 0) {
+      break;
+    }
+  }
+  return true;
+}
+
+// Stop the worker pool, and release its surfaces.
+static void pool_stop(GUI_context *c)
+{
+  struct GUI_pool *p = c->pool;
+  if (p == 0) {
+    return;
+  }
+  p->quit = true;
+  for (int32_t k = 0; k < p->nthreads; k++) {
+    SDL_SignalSemaphore(p->go);
+  }
+  for (int32_t k = 0; k < p->nthreads; k++) {
+    SDL_WaitThread(p->workers[k].thread, 0);
+  }
+  for (int32_t k = 0; k <= GUI_MAXWORKERS; k++) {
+    if (p->cairo[k] != 0) {
+      cairo_destroy(p->cairo[k]);
+      cairo_surface_destroy(p->surface[k]);
+    }
+  }
+  if (p->go != 0) {
+    SDL_DestroySemaphore(p->go);
+  }
+  if (p->done != 0) {
+    SDL_DestroySemaphore(p->done);
+  }
+  if (p->lock != 0) {
+    SDL_DestroyMutex(p->lock);
+  }
+  free(p);
+  c->pool = 0;
+}
+
+// Paint the damaged rectangles in tiles, on the calling thread and the
+// workers. Returns false if there are no workers.
+static bool paint_tiles(GUI_context *c)
+{
+  if (c->pool == 0 && pool_start(c) == false) {
+    c->workers = 0;
+    return false;
+  }
+  struct GUI_pool *p = c->pool;
+  if (p->nthreads == 0) {
+    return false;
+  }
+  // Each worker draws on its own surface over the canvas, so that cairo
+  // objects are never shared between threads. The tiles do not overlap.
+  for (int32_t k = 0; k <= p->nthreads; k++) {
+    if ((p->canvas != c->canvas || p->width != c->width ||
+         p->height != c->height) && p->cairo[k] != 0) {
+      cairo_destroy(p->cairo[k]);
+      cairo_surface_destroy(p->surface[k]);
+      p->cairo[k] = 0;
+    }
+    if (p->cairo[k] == 0) {
+      p->surface[k] = cairo_image_surface_create_for_data(
+                        c->canvas, CAIRO_FORMAT_ARGB32, c->width, c->height,
+                        c->stride);
+      p->cairo[k] = cairo_create(p->surface[k]);
+      cairo_set_font_face(p->cairo[k], c->font);
+      cairo_set_font_size(p->cairo[k], FONT_SIZE);
+      count_alloc(c);
+    }
+    cairo_surface_mark_dirty(p->surface[k]);
+    // Copy only what painting reads. The render thread owns it until the
+    // frame is done; the main thread changes the input fields meanwhile.
+    GUI_context *w = &p->ctx[k];
+    w->ctx = p->cairo[k];
+    w->list[0] = c->list[0];
+    w->list[1] = c->list[1];
+    w->cur = c->cur;
+    memcpy(w->damage, c->damage, sizeof(c->damage));
+    w->ndamage = c->ndamage;
+    w->painting = true;
+    w->font = c->font;
+    w->textlock = p->lock;
+    w->texts = c->texts;
+    w->wheels = c->wheels;
+    w->images = c->images;
+    w->image_limit = c->image_limit;
+    w->fg = c->fg;
+    w->bg = c->bg;
+    w->acc = c->acc;
+    w->prof = 0;  // Not timed per item.
+    w->paint_allocs = 0;
+  }
+  p->canvas = c->canvas;
+  p->width = c->width;
+  p->height = c->height;
+  p->nrects = c->ndamage;
+  p->first[0] = 0;
+  for (int32_t k = 0; k < c->ndamage; k++) {
+    const SDL_Rect *r = &c->damage[k];
+    p->first[k+1] = p->first[k] +
+                    ((r->w + TILE - 1) / TILE) * ((r->h + TILE - 1) / TILE);
+  }
+  SDL_SetAtomicInt(&p->next, 0);
+  for (int32_t k = 0; k < p->nthreads; k++) {
+    SDL_SignalSemaphore(p->go);
+  }
+  paint_worker(p, 0);
+  for (int32_t k = 0; k < p->nthreads; k++) {
+    SDL_WaitSemaphore(p->done);
+  }
+  for (int32_t k = 0; k <= p->nthreads; k++) {
+    c->paint_allocs += p->ctx[k].paint_allocs;
+    p->ctx[k].paint_allocs = 0;
+  }
+  // Flush what the workers drew, and tell the canvas surface about it.
+  for (int32_t k = 0; k <= p->nthreads; k++) {
+    cairo_surface_flush(p->surface[k]);
+  }
+  cairo_surface_mark_dirty(c->surface);
+  return true;
+}
+
+// Find what has changed since the last frame, and draw it.
+// Runs in the render thread, if there is one.
+static void redraw(GUI_context *c, bool full)
+{
+  const GUI_list *now = &c->list[c->cur];
+  const GUI_list *prev = &c->list[c->cur ^ 1];
+  c->painting = true;
+  c->ndamage = 0;
+  uint64_t theme = theme_hash(c);
+  if (full || theme != c->theme) {
+    damage(c, 0, 0, c->width, c->height);
+    c->theme = theme;
+  } else {
+    ptrdiff_t n = now->nitems > prev->nitems ? now->nitems : prev->nitems;
+    for (ptrdiff_t k = 0; k < n; k++) {
+      const GUI_item *a = k < now->nitems ? &now->items[k] : 0;
+      const GUI_item *b = k < prev->nitems ? &prev->items[k] : 0;
+      if (a != 0 && b != 0 && a->hash == b->hash) {
+        continue;
+      }
+      if (a != 0) {
+        damage(c, a->x, a->y, a->w, a->h);
+      }
+      if (b != 0) {
+        damage(c, b->x, b->y, b->w, b->h);
+      }
+    }
+  }
+  c->paint_pixels = 0;
+  for (int k = 0; k < c->ndamage; k++) {
+    const SDL_Rect *r = &c->damage[k];
+    c->paint_pixels += (int64_t)r->w * r->h;
+  }
+  if (c->workers <= 0 || c->paint_pixels < 2 * TILE * TILE ||
+      paint_tiles(c) == false) {
+    for (int k = 0; k < c->ndamage; k++) {
+      paint_rect(c, &c->damage[k]);
+    }
+  }
+  // Undo the cairo_save in gui_begin.
+  cairo_restore(c->ctx);
+  cairo_surface_flush(c->surface);
+  c->painting = false;
+}
+
+// Upload and show a frame that was drawn. Runs in the main thread.
+static void present(GUI_context *ctx)
+{
+  ctx->pixels = ctx->paint_pixels;
+  ctx->allocs += ctx->paint_allocs;
+  ctx->paint_allocs = 0;
+  // Upload only what was redrawn.
+  for (int k = 0; ctx->texture != 0 && k < ctx->ndamage; k++) {
+    const SDL_Rect *r = &ctx->damage[k];
+    SDL_UpdateTexture(ctx->texture, r,
+                      ctx->canvas + r->y * ctx->stride + 4 * r->x, ctx->stride);
+  }
+  if (ctx->texture != 0 && ctx->ndamage > 0) {
+    // The texture can be larger than the window.
+    SDL_FRect src = {0, 0, ctx->width, ctx->height};
+    SDL_RenderTexture(ctx->renderer, ctx->texture, &src, 0);
+    SDL_RenderPresent(ctx->renderer);
+  }
+  if (prof_on(ctx)) {
+    struct GUI_profile *p = ctx->prof;
+    Uint64 now = SDL_GetTicksNS();
+    p->frame_ns[p->frame] = now - p->begin;
+    p->latency_ns[p->frame] = 0;
+    if (p->event != 0 && ctx->ndamage > 0) {
+      p->latency_ns[p->frame] = now - p->event;
+      p->event = 0;
+    }
+  }
+}
+
+// Draws the frames that gui_end hands to it.
+static int render_thread(void *data)
+{
+  GUI_context *c = data;
+  struct GUI_render *r = c->render;
+  for (;;) {
+    SDL_WaitSemaphore(r->go);
+    if (r->quit) {
+      return 0;
+    }
+    redraw(c, r->full);
+    SDL_SignalSemaphore(r->done);
+    // Wake up the main thread, to present the frame.
+    SDL_Event ev = {.type = r->event};
+    SDL_PushEvent(&ev);
+  }
+}
+
+// Start the render thread. Returns false if that is not possible.
+static bool render_start(GUI_context *c)
+{
+  struct GUI_render *r = calloc(1, sizeof(struct GUI_render));
+  c->allocs++;
+  if (r == 0) {
+    return false;
+  }
+  r->event = SDL_RegisterEvents(1);
+  r->go = SDL_CreateSemaphore(0);
+  r->done = SDL_CreateSemaphore(0);
+  c->render = r;
+  if (r->event != 0 && r->go != 0 && r->done != 0) {
+    r->thread = SDL_CreateThread(render_thread, "render", c);
+  }
+  if (r->thread == 0) {
+    render_stop(c);
+    return false;
+  }
+  return true;
+}
+
+// Stop the render thread, after the frame it is drawing.
+static void render_stop(GUI_context *c)
+{
+  struct GUI_render *r = c->render;
+  if (r == 0) {
+    return;
+  }
+  if (c->pending) {
+    SDL_WaitSemaphore(r->done);
+    c->pending = false;
+    present(c);
+  }
+  if (r->thread != 0) {
+    r->quit = true;
+    SDL_SignalSemaphore(r->go);
+    SDL_WaitThread(r->thread, 0);
+  }
+  if (r->go != 0) {
+    SDL_DestroySemaphore(r->go);
+  }
+  if (r->done != 0) {
+    SDL_DestroySemaphore(r->done);
+  }
+  free(r);
+  c->render = 0;
+}
+
+bool gui_busy(GUI_context *ctx)
+{
+  assert(ctx);
+  if (ctx->pending && SDL_TryWaitSemaphore(ctx->render->done)) {
+    ctx->pending = false;
+    present(ctx);
+  }
+  return ctx->pending;
+}
+
+// Add the HUD to the display list. It shows the frame time, the latency
+// from input to present, and the widgets that took the most time, averaged
+// over the last PROF_WINDOW frames.
+static void hud(GUI_context *c)
+{
+  const struct GUI_profile *p = c->prof;
+  double frame = 0, frame_max = 0, latency = 0, latency_max = 0;
+  int nframes = 0, nlatency = 0;
+  for (int k = 0; k < PROF_WINDOW; k++) {
+    if (p->frame_ns[k] != 0) {
+      frame += p->frame_ns[k];
+      frame_max = fmax(frame_max, p->frame_ns[k]);
+      nframes++;
+    }
+    if (p->latency_ns[k] != 0) {
+      latency += p->latency_ns[k];
+      latency_max = fmax(latency_max, p->latency_ns[k]);
+      nlatency++;
+    }
+  }
+  // Insert the widgets into a short list, most expensive first.
+  int32_t top[PROF_TOP];
+  double cost[PROF_TOP];
+  int ntop = 0;
+  for (int32_t slot = 0; slot < p->nwidgets && slot < PROF_SLOTS; slot++) {
+    double ns = 0;
+    for (int k = 0; k < PROF_WINDOW; k++) {
+      ns += p->widget_ns[slot][k];
+    }
+    int t = ntop < PROF_TOP ? ntop++ : PROF_TOP;
+    for (; t > 0 && cost[t-1] < ns; t--) {
+      if (t < PROF_TOP) {
+        top[t] = top[t-1];
+        cost[t] = cost[t-1];
+      }
+    }
+    if (t < PROF_TOP) {
+      top[t] = slot;
+      cost[t] = ns;
+    }
+  }
+  char lines[2+PROF_TOP][64];
+  snprintf(lines[0], sizeof(lines[0]), "frame %.2f ms, max %.2f",
+           nframes ? frame / nframes / 1e6 : 0.0, frame_max / 1e6);
+  snprintf(lines[1], sizeof(lines[1]), "latency %.2f ms, max %.2f",
+           nlatency ? latency / nlatency / 1e6 : 0.0, latency_max / 1e6);
+  for (int t = 0; t < ntop; t++) {
+    snprintf(lines[2+t], sizeof(lines[2+t]), "%s %d: %.1f µs",
+             kind_names[p->kind[top[t]]], top[t],
+             nframes ? cost[t] / nframes / 1e3 : 0.0);
+  }
+  double w = 0;
+  for (int k = 0; k < 2 + ntop; k++) {
+    cairo_text_extents_t ext;
+    text_extents(c, lines[k], &ext);
+    w = fmax(w, ext.x_advance);
+  }
+  double line = m_height + 6;
+  GUI_item *it = record(c, ITEM_PANEL, 4, 4, w + 12, (2 + ntop) * line + 8,
+                        0, 0);
+  seal(c, it);
+  for (int k = 0; k < 2 + ntop; k++) {
+    gui_label(c, 10, 10 + k * line, lines[k]);
+  }
+}
+
+void gui_end(GUI_context *ctx)
+{
+  assert(ctx);
+  // Widgets react to a click or key during the frame, after parts of it
+  // were drawn. Draw one more frame to show the result.
+  ctx->dirty = ctx->dirty || ctx->button_released || ctx->keycode != 0 ||
+               ctx->textinput[0] != 0 || ctx->wheel != 0;
+  ctx->button_released = false;
+  ctx->keycode = 0;
+  ctx->mod = 0;
+  ctx->textinput[0] = 0;
+  ctx->wheel = 0;
+  // Typed text arrives as text input events only while it is started.
+  if (ctx->renderer != 0) {
+    SDL_Window *window = SDL_GetRenderWindow(ctx->renderer);
+    if (ctx->editing && SDL_TextInputActive(window) == false) {
+      SDL_StartTextInput(window);
+    } else if (ctx->editing == false && SDL_TextInputActive(window)) {
+      SDL_StopTextInput(window);
+    }
+  }
+  if (prof_on(ctx)) {
+    ctx->prof->nwidgets = ctx->list[ctx->cur].nitems;
+    hud(ctx);
+  }
+  ctx->maxid = ctx->counter;
+  bool full = ctx->full;
+  ctx->full = false;
+  // Offscreen frames are always drawn here.
+  if (ctx->threaded && ctx->renderer != 0 && ctx->render == 0) {
+    ctx->threaded = render_start(ctx);
+  }
+  if (ctx->render != 0 && ctx->renderer != 0) {
+    ctx->render->full = full;
+    ctx->pending = true;
+    SDL_SignalSemaphore(ctx->render->go);
+  } else {
+    redraw(ctx, full);
+    present(ctx);
+  }
+}
+
+void gui_close(GUI_context *ctx)
+{
+  assert(ctx);
+  render_stop(ctx);
+  pool_stop(ctx);
+  for (int k = 0; k < 2; k++) {
+    free(ctx->list[k].items);
+    free(ctx->list[k].text);
+    memset(&ctx->list[k], 0, sizeof(GUI_list));
+  }
+  if (ctx->ctx != 0) {
+    cairo_destroy(ctx->ctx);
+    cairo_surface_destroy(ctx->surface);
+    ctx->ctx = 0;
+    ctx->surface = 0;
+  }
+  free(ctx->canvas);
+  ctx->canvas = 0;
+  ctx->canvas_size = 0;
+  ctx->width = ctx->height = 0;
+  free(ctx->texts);
+  ctx->texts = 0;
+  free(ctx->prof);
+  ctx->prof = 0;
+  if (ctx->wheels != 0) {
+    for (int k = 0; k < WHEEL_CACHE; k++) {
+      if (ctx->wheels->e[k].disc != 0) {
+        cairo_surface_destroy(ctx->wheels->e[k].disc);
+      }
+    }
+    free(ctx->wheels);
+    ctx->wheels = 0;
+  }
+  if (ctx->images != 0) {
+    for (int k = 0; k < IMAGE_CACHE; k++) {
+      free(ctx->images->e[k].path);
+      if (ctx->images->e[k].surface != 0) {
+        cairo_surface_destroy(ctx->images->e[k].surface);
+      }
+    }
+    free(ctx->images);
+    ctx->images = 0;
+  }
+  if (ctx->textures != 0) {
+    for (int k = 0; k < TEXTURE_POOL; k++) {
+      if (ctx->textures->e[k].texture != 0) {
+        SDL_DestroyTexture(ctx->textures->e[k].texture);
+      }
+    }
+    free(ctx->textures);
+    ctx->textures = 0;
+  }
+  ctx->texture = 0;
+  if (ctx->font != 0) {
+    cairo_font_face_destroy(ctx->font);
+    ctx->font = 0;
+  }
+}
+
+void gui_theme_light(GUI_context *ctx)
+{
+  ctx->bg = (GUI_rgb) {
+    0.992157, 0.964706, 0.890196
+  }; // Base3 #fdf6e3
+  ctx->fg = (GUI_rgb) {
+    0.345098, 0.431373, 0.458824
+  }; // Base01 #586e75
+  ctx->acc = (GUI_rgb) {
+    0.14902, 0.545098, 0.823529
+  }; // Blue #268bd2
+}
+
+void gui_theme_dark(GUI_context *ctx)
+{
+  ctx->bg = (GUI_rgb) {
+    0.027451, 0.211765, 0.258824
+  }; // Base02 #073642
+  ctx->fg = (GUI_rgb) {
+    0.576471, 0.631373, 0.631373
+  }; // Base1 #93a1a1
+  ctx->acc = (GUI_rgb) {
+    0.14902, 0.545098, 0.823529
+  }; // Blue #268bd2
+}
+
+bool gui_record(const GUI_context *ctx, FILE *f)
+{
+  assert(ctx);
+  assert(f);
+  if (ctx->textinput[0] != 0) {
+    // As hexadecimal, so that it fits on one line.
+    fputs("text ", f);
+    for (const char *t = ctx->textinput; *t; t++) {
+      fprintf(f, "%02x", (unsigned char)*t);
+    }
+    fputc('\n', f);
+  }
+  return fprintf(f, "input %d %d %d %d %d %d %d %d\n", ctx->mouse_x,
+                 ctx->mouse_y, ctx->button_pressed, ctx->button_released,
+                 ctx->keycode, ctx->mod, ctx->id, ctx->wheel) > 0;
+}
+
+bool gui_replay(GUI_context *ctx, const char *line)
+{
+  assert(ctx);
+  assert(line);
+  int x, y, pressed, released, keycode, mod, id, wheel = 0;
+  if (strncmp(line, "text ", 5) == 0) {
+    size_t n = 0;
+    unsigned int byte;
+    line += 5;
+    while (n < sizeof(ctx->textinput) - 1 && sscanf(line, "%2x", &byte) == 1) {
+      ctx->textinput[n++] = byte;
+      line += 2;
+    }
+    ctx->textinput[n] = 0;
+    return false;
+  }
+  // The wheel was added later; older recordings lack it.
+  if (sscanf(line, "input %d %d %d %d %d %d %d %d", &x, &y, &pressed,
+             &released, &keycode, &mod, &id, &wheel) < 7) {
+    return false;
+  }
+  ctx->mouse_x = x;
+  ctx->mouse_y = y;
+  ctx->button_pressed = pressed != 0;
+  ctx->button_released = released != 0;
+  ctx->keycode = keycode;
+  ctx->mod = mod;
+  ctx->id = id;
+  ctx->wheel = wheel;
+  ctx->dirty = true;
+  return true;
+}
+
+// Append typed text; several events can arrive before the next frame.
+// Text that does not fit is dropped.
+static void add_textinput(GUI_context *ctx, const char *text)
+{
+  size_t used = strlen(ctx->textinput);
+  size_t len = strlen(text);
+  if (used + len < sizeof(ctx->textinput)) {
+    memcpy(ctx->textinput + used, text, len + 1);
+  }
+}
+
+SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event)
+{
+  if (ctx->render != 0 && event->type == ctx->render->event) {
+    gui_busy(ctx); // Presents the frame.
+    return SDL_APP_CONTINUE;
+  }
+  switch (event->type) {
+    case SDL_EVENT_KEY_DOWN:
+    case SDL_EVENT_TEXT_INPUT:
+    case SDL_EVENT_MOUSE_MOTION:
+    case SDL_EVENT_MOUSE_WHEEL:
+    case SDL_EVENT_MOUSE_BUTTON_DOWN:
+    case SDL_EVENT_MOUSE_BUTTON_UP:
+      // Remember when the input started that the next present shows.
+      if (prof_on(ctx) && ctx->prof->event == 0) {
+        ctx->prof->event = event->common.timestamp;
+      }
+      break;
+    default:
+      break;
+  }
+  switch (event->type) {
+    case SDL_EVENT_WINDOW_MINIMIZED:
+    case SDL_EVENT_WINDOW_HIDDEN:
+    case SDL_EVENT_WINDOW_OCCLUDED:
+      ctx->hidden = true;
+      break;
+    case SDL_EVENT_WINDOW_RESTORED:
+    case SDL_EVENT_WINDOW_SHOWN:
+    case SDL_EVENT_WINDOW_EXPOSED:
+      ctx->hidden = false;
+      ctx->dirty = true;
+      ctx->full = true;
+      break;
+    case SDL_EVENT_WINDOW_RESIZED:
+      // The canvas and texture follow in the next gui_begin, so that a
+      // drag-resize changes them at most once per frame.
+      ctx->resized = true;
+      ctx->dirty = true;
+      ctx->full = true;
+      break;
+    case SDL_EVENT_QUIT:
+      return SDL_APP_SUCCESS;
+      break;
+    case SDL_EVENT_TEXT_INPUT:
+      add_textinput(ctx, event->text.text);
+      ctx->dirty = true;
+      break;
+    case SDL_EVENT_KEY_DOWN:
+      if ((event->key.key == 'q' && ctx->editing == false) ||
+          event->key.key == SDLK_ESCAPE) {
+        return SDL_APP_SUCCESS;
+      } else if (event->key.key == SDLK_F12) {
+        ctx->hud = !ctx->hud;
+      } else if (event->key.key == SDLK_TAB) {
+        if (event->key.mod & (SDL_KMOD_LSHIFT|SDL_KMOD_RSHIFT)) {
+          ctx->id--;
+          if (ctx->id < 0) {
+            ctx->id = ctx->maxid;
+          }
+        } else {
+          ctx->id++;
+          if (ctx->id > ctx->maxid) {
+            ctx->id = 1;
+          }
+        }
+      } else {
+        ctx->keycode = event->key.key;
+        ctx->mod = event->key.mod;
+      }
+      ctx->dirty = true;
+      break;
+    case SDL_EVENT_MOUSE_MOTION:
+      ctx->mouse_x = event->motion.x;
+      ctx->mouse_y = event->motion.y;
+      ctx->dirty = true;
+      break;
+    case SDL_EVENT_MOUSE_WHEEL:
+      // Whole steps; fractions of smooth scrolling are dropped.
+      ctx->wheel += (int32_t)event->wheel.y;
+      ctx->dirty = true;
+      break;
+    case SDL_EVENT_MOUSE_BUTTON_DOWN:
+      ctx->button_pressed = true;
+      ctx->button_released = false;
+      ctx->dirty = true;
+      break;
+    case SDL_EVENT_MOUSE_BUTTON_UP:
+      ctx->button_pressed = false;
+      ctx->button_released = true;
+      ctx->dirty = true;
+      break;
+    default:
+      if (ctx->button_released) {
+        ctx->button_released = false;
+      }
+      break;
+  }
+  return SDL_APP_CONTINUE;
+}
+
+// Focus of a widget that takes typed text. It gets the focus (c->id) when
+// the mouse is over it, but keys are only text after a click in it, or when
+// Tab moved the focus to it; a click elsewhere ends that. So moving the
+// mouse over it does not swallow shortcuts. Returns true if it has the focus.
+static bool take_focus(GUI_context *c, int32_t id, bool inside, bool *hovered,
+                       bool *focus)
+{
+  if (c->id != id) {
+    *hovered = false;
+    *focus = false;
+  } else if (*hovered == false) {
+    *focus = true;  // Reached with Tab.
+  }
+  if (inside == false && c->id != id) {
+    return false;
+  }
+  *hovered = *hovered || c->id != id;
+  if (c->button_pressed) {
+    *focus = inside;
+    *hovered = true;
+  }
+  c->id = id;
+  c->editing = c->editing || *focus;
+  return true;
+}
+
+// Draw the label of a button. Also used for gui_label.
+static void paint_text(GUI_context *c, double x, double y, const char *text)
+{
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  show_text(c, x, y, text);
+}
+
+static void paint_button(GUI_context *c, const GUI_item *it, const char *label)
+{
+  double offset = 10.0;
+  // Draw button outline.
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_rectangle(c->ctx, it->x, it->y, it->w, it->h);
+  cairo_stroke(c->ctx);
+  // draw/Fill inside if mouse is inside, or we have the highlight.
+  if (it->flags & HOVER) {
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+    cairo_rectangle(c->ctx, it->x+1, it->y+1, it->w-2, it->h-2);
+    if (it->flags & PRESSED) {
+      cairo_fill(c->ctx);
+    } else {
+      cairo_stroke(c->ctx);
+    }
+  }
+  // Draw the label
+  paint_text(c, it->x + offset, it->y + offset + it->v[0], label);
+}
+
+bool gui_button(GUI_context *c, double x, double y, const char *label)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  // All interactive widgets should get an ID by increasing the counter.
+  int32_t id = c->counter++;
+  double rv = false;
+  double offset = 10.0;
+  cairo_text_extents_t ext;
+  text_extents(c, label, &ext);
+  double width = 2*offset + ext.width;
+  double height = 2*offset +ext.height;
+  int32_t flags = 0;
+  // Highlight if mouse is inside, or we have the highlight.
+  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
+      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
+    c->id = id;
+    flags = HOVER | (c->button_pressed ? PRESSED : 0);
+    if (c->button_released || c->keycode == SDLK_RETURN) {
+      rv = true;
+    }
+  }
+  GUI_item *it = record(c, ITEM_BUTTON, x, y, width, height, label,
+                        strlen(label) + 1);
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = ext.height;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return rv;
+}
+
+void gui_label(GUI_context *c, double x, double y, const char *label)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  // Labels don't interact, so they have no id.
+  cairo_text_extents_t ext;
+  text_extents(c, label, &ext);
+  double box[4] = {x, y, x, y};
+  text_box(box, x, y + ext.height, &ext);
+  GUI_item *it = record(c, ITEM_LABEL, box[0], box[1], box[2] - box[0],
+                        box[3] - box[1], label, strlen(label) + 1);
+  if (it != 0) {
+    it->v[0] = x;
+    it->v[1] = y + ext.height;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+}
+
+static void paint_checkbox(GUI_context *c, const GUI_item *it, const char *label)
+{
+  double x = it->v[0], y = it->v[1];
+  double boxsize = it->v[2];
+  double offset = 5.0;
+  // Draw checkbox outline.
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_rectangle(c->ctx, x, y, boxsize, boxsize);
+  cairo_stroke(c->ctx);
+  // draw/Fill inside if mouse is inside, or we have the highlight.
+  if (it->flags & HOVER) {
     cairo_new_path(c->ctx);
     cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cury = y + boxsize/2;
-    curx = x + boxsize/2;
+    cairo_rectangle(c->ctx, x+1, y+1, boxsize-2, boxsize-2);
+    if (it->flags & PRESSED) {
+      cairo_fill(c->ctx);
+    } else {
+      cairo_stroke(c->ctx);
+    }
+  }
+  // Draw selected mark if needed.
+  if (it->flags & CHECKED) {
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+    cairo_move_to(c->ctx, x, y);
+    cairo_rel_line_to(c->ctx, boxsize, boxsize);
+    cairo_rel_move_to(c->ctx, 0, -boxsize);
+    cairo_rel_line_to(c->ctx, -boxsize, boxsize);
+    cairo_stroke(c->ctx);
+  }
+  // Draw the label
+  paint_text(c, x + boxsize + offset, y + boxsize/2 + it->v[3]/2, label);
+}
+
+bool gui_checkbox(GUI_context *c, double x, double y, const char *label, bool *state)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  int32_t id = c->counter++;
+  double rv = false;
+  double offset = 5.0;
+  double boxsize = m_width>m_height?m_width:m_height;
+  cairo_text_extents_t ext;
+  text_extents(c, label, &ext);
+  double width = 2*offset + ext.width + boxsize;
+  double height = 2*offset + ext.height>boxsize?ext.height:boxsize;
+  int32_t flags = 0;
+  // Highlight if mouse is inside, or we have the highlight.
+  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
+      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
+    c->id = id;
+    flags = HOVER | (c->button_pressed ? PRESSED : 0);
+    if (c->button_released || c->keycode == SDLK_RETURN) {
+      rv = true;
+      *state = !*state;
+    }
+  }
+  if (*state) {
+    flags |= CHECKED;
+  }
+  double box[4] = {x, y, x + boxsize, y + boxsize};
+  text_box(box, x + boxsize + offset, y + boxsize/2 + ext.height/2, &ext);
+  GUI_item *it = record(c, ITEM_CHECKBOX, box[0], box[1], box[2] - box[0],
+                        box[3] - box[1], label, strlen(label) + 1);
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = x;
+    it->v[1] = y;
+    it->v[2] = boxsize;
+    it->v[3] = ext.height;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return rv;
+}
+
+static void paint_radiobuttons(GUI_context *c, const GUI_item *it,
+                               const char *labels)
+{
+  int nlabels = it->v[0];
+  int state = it->v[1];
+  int hover = it->v[2];
+  double x = it->x, y = it->y;
+  double offset = 5.0;
+  double boxsize = (m_width>m_height?m_width:m_height)*1.5;
+  // Draw the buttons and the selected one
+  int cury = y + boxsize/2;
+  int curx = x + boxsize/2;
+  const char *label = labels;
+  double exty[nlabels], heights[nlabels];
+  for (int k = 0; k < nlabels; k++) {
+    cairo_text_extents_t ext;
+    text_extents(c, label, &ext);
+    heights[k] = ext.height>boxsize?ext.height:boxsize;
+    exty[k] = ext.height;
+    label += strlen(label) + 1;
+  }
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  for (int k = 0; k < nlabels; k++) {
+    cairo_new_path(c->ctx);
+    cairo_arc(c->ctx, curx, cury, boxsize/2 - 2, 0.0, 2*M_PI);
+    cairo_stroke(c->ctx);
+    if (state == k) {
+      cairo_new_path(c->ctx);
+      cairo_arc(c->ctx, curx, cury, boxsize/2 - 4, 0.0, 2*M_PI);
+      cairo_fill(c->ctx);
+    }
+    if (hover == k) {
+      // This is the label under the mouse.
+      cairo_new_path(c->ctx);
+      cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+      cairo_arc(c->ctx, curx, cury, boxsize/2 - 3, 0.0, 2*M_PI);
+      if (it->flags & PRESSED) {
+        cairo_fill(c->ctx);
+      } else {
+        cairo_stroke(c->ctx);
+      }
+      cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+    }
+    cury += heights[k];
+  }
+  // Draw the labels
+  cury = y + offset;
+  curx = x + boxsize + offset;
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  label = labels;
+  for (int k = 0; k < nlabels; k++) {
+    show_text(c, curx, cury+exty[k]/2, label);
+    cury += heights[k];
+    label += strlen(label) + 1;
+  }
+}
+
+bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
+                      const char *labels[nlabels], int *state)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  assert(labels);
+  assert(nlabels > 0);
+  int32_t id = c->counter++;
+  double rv = false;
+  double offset = 5.0;
+  //double boxsize = 14.0;
+  double boxsize = (m_width>m_height?m_width:m_height)*1.5;
+  double width, height;
+  double heights[nlabels];
+  double exty[nlabels];
+  cairo_text_extents_t ext = {0};
+  text_extents(c, labels[0], &ext);
+  width = ext.width;
+  height = ext.height;
+  heights[0] = ext.height>boxsize?ext.height:boxsize;
+  exty[0] = ext.height;
+  double total = heights[0];
+  size_t textlen = strlen(labels[0]) + 1;
+  for (int k = 1; k < nlabels; k++) {
+    text_extents(c, labels[k], &ext);
+    heights[k] = ext.height>boxsize?ext.height:boxsize;
+    exty[k] = ext.height;
+    if (width < ext.width) {
+      width = ext.width;
+    }
+    height += heights[k];
+    total += heights[k];
+    textlen += strlen(labels[k]) + 1;
+  }
+  width += 2*offset + boxsize;
+  height += 2*offset;
+  int32_t flags = 0;
+  int hover = -1;
+  // Highlight if mouse is inside, or we have the highlight.
+  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
+      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
+    c->id = id;
+    flags = c->button_pressed ? PRESSED : 0;
+    int cury = y + boxsize/2;
     for (int k = 0; k < nlabels; k++) {
       if ((fabs((double)c->mouse_y - cury) < exty[k]/2)) {
         // This is the label!
-        cairo_new_path(c->ctx);
-        cairo_arc(c->ctx, curx, cury, boxsize/2 - 3, 0.0, 2*M_PI);
-        if (c->button_pressed) {
-          cairo_fill(c->ctx);
-        } else {
-          cairo_stroke(c->ctx);
-        }
+        hover = k;
         if (c->button_released || c->keycode == SDLK_RETURN) {
           rv = true;
           *state = k;
@@ -348,6 +1673,24 @@ bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
       cury += heights[k];
     }
   }
+  // The labels are stored one after another.
+  char text[textlen];
+  char *cur = text;
+  for (int k = 0; k < nlabels; k++) {
+    size_t len = strlen(labels[k]) + 1;
+    memcpy(cur, labels[k], len);
+    cur += len;
+  }
+  GUI_item *it = record(c, ITEM_RADIOBUTTONS, x, y, width,
+                        fmax(height, total + boxsize/2), text, textlen);
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = nlabels;
+    it->v[1] = *state;
+    it->v[2] = hover;
+  }
+  seal(c, it);
+  prof_stop(c, start);
   return rv;
 }
 
@@ -355,38 +1698,354 @@ void gui_colorsample(GUI_context *c, const double x, const double y,
                      const double w, const double h, const GUI_rgb *state)
 {
   assert(c);
+  Uint64 start = prof_start(c);
   assert(state);
+  GUI_item *it = record(c, ITEM_COLORSAMPLE, x, y, w, h, 0, 0);
+  if (it != 0) {
+    it->v[0] = state->r;
+    it->v[1] = state->g;
+    it->v[2] = state->b;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+}
+
+static void paint_colorsample(GUI_context *c, const GUI_item *it)
+{
   cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, state->r, state->g, state->b);
-  cairo_rectangle(c->ctx, x, y, w, h);
+  cairo_set_source_rgb(c->ctx, it->v[0], it->v[1], it->v[2]);
+  cairo_rectangle(c->ctx, it->x, it->y, it->w, it->h);
   cairo_fill(c->ctx);
 }
 
-bool gui_slider(GUI_context *c, const double x, const double y, int *state)
+// One channel of a HSV color, with the hue “h” in sextants; n is 5 for red,
+// 3 for green and 1 for blue. Without branches, so that loops over it can
+// be vectorized.
+static inline double hsv_channel(double n, double h, double s, double v)
+{
+  double k = n + h;
+  k -= 6.0 * (k >= 6.0);
+  return v - v * s * fmax(0.0, fmin(fmin(k, 4.0 - k), 1.0));
+}
+
+void gui_hsv_to_rgb(const GUI_hsv *in, GUI_rgb *out)
+{
+  assert(in);
+  assert(out);
+  double h = fmod(in->h, 360.0) / 60.0;
+  h += 6.0 * (h < 0.0);
+  out->r = hsv_channel(5.0, h, in->s, in->v);
+  out->g = hsv_channel(3.0, h, in->s, in->v);
+  out->b = hsv_channel(1.0, h, in->s, in->v);
+}
+
+void gui_rgb_to_hsv(const GUI_rgb *in, GUI_hsv *out)
+{
+  assert(in);
+  assert(out);
+  double max = fmax(in->r, fmax(in->g, in->b));
+  double min = fmin(in->r, fmin(in->g, in->b));
+  double d = max - min;
+  out->v = max;
+  out->s = max > 0.0 ? d / max : 0.0;
+  if (d == 0.0) {
+    return;  // Gray; keep the hue.
+  } else if (max == in->r) {
+    out->h = 60.0 * fmod((in->g - in->b) / d + 6.0, 6.0);
+  } else if (max == in->g) {
+    out->h = 60.0 * ((in->b - in->r) / d + 2.0);
+  } else {
+    out->h = 60.0 * ((in->r - in->g) / d + 4.0);
+  }
+}
+
+// Fill “px” with a hue/saturation disc at full value, “size” pixels across,
+// as premultiplied ARGB32. Hue 0 (red) points right, and goes around
+// counterclockwise.
+static void wheel_kernel(uint32_t *px, int32_t stride, int32_t size)
+{
+  double r = size / 2.0;
+  for (int32_t y = 0; y < size; y++) {
+    uint32_t *row = px + y * stride;
+    double dy = r - (y + 0.5);
+    for (int32_t x = 0; x < size; x++) {
+      double dx = (x + 0.5) - r;
+      double d = sqrt(dx * dx + dy * dy);
+      double h = atan2(dy, dx) * (3.0 / M_PI);
+      h += 6.0 * (h < 0.0);
+      double s = fmin(d / r, 1.0);
+      double a = fmin(fmax(r - d + 0.5, 0.0), 1.0) * 255.0;  // Smooth edge.
+      row[x] = (uint32_t)(a + 0.5) << 24 |
+               (uint32_t)(hsv_channel(5.0, h, s, 1.0) * a + 0.5) << 16 |
+               (uint32_t)(hsv_channel(3.0, h, s, 1.0) * a + 0.5) << 8 |
+               (uint32_t)(hsv_channel(1.0, h, s, 1.0) * a + 0.5);
+    }
+  }
+}
+
+// Find the disc of diameter “size” in the cache, or make it.
+// Returns 0 if there is not enough memory.
+static cairo_surface_t *wheel_disc(GUI_context *c, int32_t size)
+{
+  if (c->wheels == 0) {
+    c->wheels = calloc(1, sizeof(struct GUI_wheels));
+    count_alloc(c);
+    if (c->wheels == 0) {
+      return 0;
+    }
+  }
+  struct GUI_wheels *w = c->wheels;
+  w->clock++;
+  int victim = 0;
+  for (int k = 0; k < WHEEL_CACHE; k++) {
+    if (w->e[k].disc != 0 && w->e[k].size == size) {
+      w->e[k].used = w->clock;
+      return w->e[k].disc;
+    }
+    if (w->e[k].used < w->e[victim].used) {
+      victim = k;
+    }
+  }
+  if (w->e[victim].disc != 0) {
+    cairo_surface_destroy(w->e[victim].disc);
+    w->e[victim].disc = 0;
+  }
+  cairo_surface_t *disc = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                     size, size);
+  count_alloc(c);
+  if (cairo_surface_status(disc) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(disc);
+    return 0;
+  }
+  cairo_surface_flush(disc);
+  wheel_kernel((uint32_t*)cairo_image_surface_get_data(disc),
+               cairo_image_surface_get_stride(disc) / 4, size);
+  cairo_surface_mark_dirty(disc);
+  w->e[victim].disc = disc;
+  w->e[victim].size = size;
+  w->e[victim].used = w->clock;
+  return disc;
+}
+
+static void paint_colorwheel(GUI_context *c, const GUI_item *it)
+{
+  double size = it->v[3];
+  int32_t d = size - 2 * WHEEL_PAD;
+  double r = d / 2.0;
+  double cx = it->x + WHEEL_PAD + r, cy = it->y + WHEEL_PAD + r;
+  double hue = it->v[0], sat = it->v[1], val = it->v[2];
+  // The disc was made by gui_colorwheel. Only read the cache here, since
+  // tiles can be painted in several threads.
+  for (int k = 0; c->wheels != 0 && k < WHEEL_CACHE; k++) {
+    if (c->wheels->e[k].disc != 0 && c->wheels->e[k].size == d) {
+      cairo_new_path(c->ctx);
+      cairo_set_source_surface(c->ctx, c->wheels->e[k].disc, cx - r, cy - r);
+      cairo_rectangle(c->ctx, cx - r, cy - r, d, d);
+      cairo_fill(c->ctx);
+      break;
+    }
+  }
+  // Darken it to the value.
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgba(c->ctx, 0.0, 0.0, 0.0, 1.0 - val);
+  cairo_arc(c->ctx, cx, cy, r, 0.0, 2*M_PI);
+  cairo_fill(c->ctx);
+  if (it->flags & HOVER) {
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+    cairo_arc(c->ctx, cx, cy, r + 3, 0.0, 2*M_PI);
+    cairo_stroke(c->ctx);
+  }
+  // Mark the selection, visible on both light and dark colors.
+  double a = hue * M_PI / 180.0;
+  double mx = cx + cos(a) * sat * r, my = cy - sin(a) * sat * r;
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, 0.0, 0.0, 0.0);
+  cairo_arc(c->ctx, mx, my, 4.0, 0.0, 2*M_PI);
+  cairo_stroke(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, 1.0, 1.0, 1.0);
+  cairo_arc(c->ctx, mx, my, 3.0, 0.0, 2*M_PI);
+  cairo_stroke(c->ctx);
+  // The value bar, from the full color at the top to black.
+  double bx = it->x + size + WHEEL_PAD, by = it->y + WHEEL_PAD;
+  GUI_hsv full = {hue, sat, 1.0};
+  GUI_rgb top;
+  gui_hsv_to_rgb(&full, &top);
+  cairo_pattern_t *grad = cairo_pattern_create_linear(bx, by, bx, by + d);
+  count_alloc(c);
+  cairo_pattern_add_color_stop_rgb(grad, 0.0, top.r, top.g, top.b);
+  cairo_pattern_add_color_stop_rgb(grad, 1.0, 0.0, 0.0, 0.0);
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, bx, by, WHEEL_BAR, d);
+  cairo_set_source(c->ctx, grad);
+  cairo_fill_preserve(c->ctx);
+  cairo_pattern_destroy(grad);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_stroke(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_move_to(c->ctx, bx - 2, by + (1.0 - val) * d);
+  cairo_rel_line_to(c->ctx, WHEEL_BAR + 4, 0);
+  cairo_stroke(c->ctx);
+}
+
+bool gui_colorwheel(GUI_context *c, const double x, const double y,
+                    const double size, GUI_hsv *state)
 {
   assert(c);
+  Uint64 start = prof_start(c);
   assert(state);
+  assert(size > 2 * WHEEL_PAD);
   int32_t id = c->counter++;
   bool changed = false;
+  int32_t d = size - 2 * WHEEL_PAD;
+  double r = d / 2.0;
+  double width = size + 2 * WHEEL_PAD + WHEEL_BAR;
+  int32_t flags = 0;
+  // Made once per size; the frames after that only draw the markers.
+  wheel_disc(c, d);
+  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
+      c->mouse_y >= y && (c->mouse_y - y) <= size)|| c->id == id) {
+    c->id = id;
+    flags = HOVER;
+    GUI_hsv old = *state;
+    if (c->button_pressed && c->mouse_x < x + size) {
+      // Pick hue and saturation; outside the disc, on its edge.
+      double dx = c->mouse_x - (x + WHEEL_PAD + r);
+      double dy = (y + WHEEL_PAD + r) - c->mouse_y;
+      state->h = fmod(atan2(dy, dx) * 180.0 / M_PI + 360.0, 360.0);
+      state->s = fmin(sqrt(dx * dx + dy * dy) / r, 1.0);
+    } else if (c->button_pressed) {
+      state->v = 1.0 - (c->mouse_y - y - WHEEL_PAD) / d;
+    }
+    if (c->keycode == SDLK_LEFT) {
+      state->h = fmod(state->h + 359.0, 360.0);
+    } else if (c->keycode == SDLK_RIGHT) {
+      state->h = fmod(state->h + 1.0, 360.0);
+    } else if (c->keycode == SDLK_UP) {
+      state->v += 1.0 / 255.0;
+    } else if (c->keycode == SDLK_DOWN) {
+      state->v -= 1.0 / 255.0;
+    }
+    state->v = fmin(fmax(state->v, 0.0), 1.0);
+    changed = memcmp(&old, state, sizeof(GUI_hsv)) != 0;
+  }
+  GUI_item *it = record(c, ITEM_COLORWHEEL, x, y, width, size, 0, 0);
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = state->h;
+    it->v[1] = state->s;
+    it->v[2] = state->v;
+    it->v[3] = size;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return changed;
+}
+
+static void paint_slider(GUI_context *c, const GUI_item *it)
+{
   const double xsize = 20.0;
   const double ysize = 10.0;
   const double offset = 4.0;
-  const double width = 255.0 + xsize + 2*offset;
-  const double height = ysize + 2*offset;
+  double x = it->x, y = it->y;
   // Draw outside rectangle
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, width, height);
+  cairo_rectangle(c->ctx, x, y, it->w, it->h);
   cairo_stroke(c->ctx);
-  // draw/Fill inside if mouse is inside, or we have the highlight.
-  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
-      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
-    c->id = id;
-    // draw inside if mouse is inside.
+  // draw inside if mouse is inside.
+  if (it->flags & HOVER) {
     cairo_new_path(c->ctx);
     cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+2, y+2, width-4, height-4);
+    cairo_rectangle(c->ctx, x+2, y+2, it->w-4, it->h-4);
+    cairo_stroke(c->ctx);
+  }
+  // Draw the color ramp of the track, made by gui_slider_gradient.
+  if (it->surface != 0) {
+    cairo_new_path(c->ctx);
+    cairo_set_source_surface(c->ctx, it->surface, x + offset, y + offset);
+    cairo_rectangle(c->ctx, x + offset, y + offset, 255.0 + xsize, ysize);
+    cairo_fill(c->ctx);
+  }
+  // Draw slider
+  double sliderpos = x + it->v[0] + offset;
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_rectangle(c->ctx, sliderpos, y + offset, xsize, ysize);
+  if (it->surface != 0) {
+    // Keep it visible on the ramp.
+    cairo_fill_preserve(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->bg.r, c->bg.g, c->bg.b);
     cairo_stroke(c->ctx);
+  } else {
+    cairo_fill(c->ctx);
+  }
+}
+
+// Pack a color in 24 bits, to compare and hash it.
+static double pack_rgb(const GUI_rgb *c)
+{
+  return lround(c->r * 255) << 16 | lround(c->g * 255) << 8 |
+         lround(c->b * 255);
+}
+
+// Render the ramp of a gradient track, if its colors have changed.
+static void render_gradient(GUI_context *c, GUI_gradient *track)
+{
+  const double xsize = 20.0;
+  const int32_t w = 255 + xsize, h = 10;
+  if (track->surface != 0 && pack_rgb(&track->from) == track->made[0] &&
+      pack_rgb(&track->to) == track->made[1]) {
+    return;
+  }
+  if (track->surface == 0) {
+    track->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+    count_alloc(c);
+    if (cairo_surface_status(track->surface) != CAIRO_STATUS_SUCCESS) {
+      cairo_surface_destroy(track->surface);
+      track->surface = 0;
+      return;
+    }
+  }
+  // The color under the middle of the thumb is that of the value.
+  cairo_t *cr = cairo_create(track->surface);
+  cairo_pattern_t *ramp = cairo_pattern_create_linear(xsize / 2, 0,
+                                                      xsize / 2 + 255, 0);
+  count_alloc(c);
+  cairo_pattern_add_color_stop_rgb(ramp, 0.0, track->from.r, track->from.g,
+                                   track->from.b);
+  cairo_pattern_add_color_stop_rgb(ramp, 1.0, track->to.r, track->to.g,
+                                   track->to.b);
+  cairo_set_source(cr, ramp);
+  cairo_paint(cr);
+  cairo_pattern_destroy(ramp);
+  cairo_destroy(cr);
+  cairo_surface_flush(track->surface);
+  track->made[0] = pack_rgb(&track->from);
+  track->made[1] = pack_rgb(&track->to);
+}
+
+// A slider, with a color ramp under the thumb if “track” is not 0.
+static bool slider(GUI_context *c, const double x, const double y,
+                   int *state, GUI_gradient *track)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  assert(state);
+  int32_t id = c->counter++;
+  bool changed = false;
+  const double xsize = 20.0;
+  const double ysize = 10.0;
+  const double offset = 4.0;
+  const double width = 255.0 + xsize + 2*offset;
+  const double height = ysize + 2*offset;
+  int32_t flags = 0;
+  // Highlight if mouse is inside, or we have the highlight.
+  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
+      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
+    c->id = id;
+    flags = HOVER;
     // Update state if mouse is inside and button is pressed
     if (c->button_pressed || c->keycode == SDLK_RETURN) {
       int newstate = round(c->mouse_x - x - offset - xsize/2.0);
@@ -415,33 +2074,55 @@ bool gui_slider(GUI_context *c, const double x, const double y, int *state)
   } else if (*state > 255) {
     *state = 255;
   }
-  // Draw slider
-  double sliderpos = x + (double)*state + offset;
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, sliderpos, y + offset, xsize, ysize);
-  cairo_fill(c->ctx);
+  if (track != 0) {
+    render_gradient(c, track);
+  }
+  GUI_item *it = record(c, ITEM_SLIDER, x, y, width, height, 0, 0);
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = *state;
+    if (track != 0 && track->surface != 0) {
+      it->v[1] = track->made[0];
+      it->v[2] = track->made[1];
+      it->surface = track->surface;
+    }
+  }
+  seal(c, it);
+  prof_stop(c, start);
   return changed;
 }
 
-bool gui_ispinner(GUI_context *c, const double x, const double y,
-                 int32_t min, int32_t max, int32_t*state)
+bool gui_slider(GUI_context *c, const double x, const double y, int *state)
+{
+  return slider(c, x, y, state, 0);
+}
+
+bool gui_slider_gradient(GUI_context *c, const double x, const double y,
+                         int *state, GUI_gradient *track)
+{
+  assert(track);
+  return slider(c, x, y, state, track);
+}
+
+void gui_gradient_free(GUI_gradient *track)
+{
+  assert(track);
+  if (track->surface != 0) {
+    cairo_surface_destroy(track->surface);
+  }
+  track->surface = 0;
+}
+
+static void paint_spinner(GUI_context *c, const GUI_item *it)
 {
-  assert(c);
-  assert(state);
-  assert(max > min);
-  int32_t id = c->counter++;
-  bool rv = false;
-  // Determine the amount of characters needed
-  double maxw = ceil(log10(fabs((double)max))) * m_width;
   const double offset = 6.0;
   const double boxsize = 12.0;
-  double width = maxw + 2 * offset + 2*boxsize;
-  double height = m_height + 2 * offset;
+  double x = it->x, y = it->y;
+  double maxw = it->v[1];
   // Draw the outline.
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, width, height);
+  cairo_rectangle(c->ctx, x, y, it->w, it->h);
   cairo_stroke(c->ctx);
   // Draw the spinner buttons.
   cairo_new_path(c->ctx);
@@ -460,14 +2141,43 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
   cairo_rel_line_to(c->ctx, -boxsize/2, -boxsize);
   cairo_close_path(c->ctx);
   cairo_fill(c->ctx);
-  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
-      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
-    c->id = id;
+  if (it->flags & HOVER) {
     // Draw inside accent if mouse is inside.
     cairo_new_path(c->ctx);
     cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+2, y+2, width-4, height-4);
+    cairo_rectangle(c->ctx, x+2, y+2, it->w-4, it->h-4);
     cairo_stroke(c->ctx);
+  }
+  // Draw the number
+  char buf[20];
+  snprintf(buf, 19, "%d", (int32_t)it->v[0]);
+  cairo_text_extents_t ext;
+  text_extents(c, buf, &ext);
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  show_text(c, x+offset, y+offset+ext.height, buf);
+}
+
+bool gui_ispinner(GUI_context *c, const double x, const double y,
+                 int32_t min, int32_t max, int32_t*state)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  assert(state);
+  assert(max > min);
+  int32_t id = c->counter++;
+  bool rv = false;
+  // Determine the amount of characters needed
+  double maxw = ceil(log10(fabs((double)max))) * m_width;
+  const double offset = 6.0;
+  const double boxsize = 12.0;
+  double width = maxw + 2 * offset + 2*boxsize;
+  double height = m_height + 2 * offset;
+  int32_t flags = 0;
+  if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
+      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
+    c->id = id;
+    flags = HOVER;
     if (c->button_pressed) {
       double xdist =  c->mouse_x - x - offset - maxw;
       if (xdist < boxsize) {
@@ -500,118 +2210,894 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
         break;
     }
   }
-  // Clamp the state between min and max.
-  if (*state > max) {
-    *state = max;
-  } else if (*state < min) {
-    *state = min;
+  // Clamp the state between min and max.
+  if (*state > max) {
+    *state = max;
+  } else if (*state < min) {
+    *state = min;
+  }
+  GUI_item *it = record(c, ITEM_SPINNER, x, y, width, height, 0, 0);
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = *state;
+    it->v[1] = maxw;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return rv;
+}
+
+static void paint_editbox(GUI_context *c, const GUI_item *it, const char *text)
+{
+  const double offset = 6.0;
+  double x = it->v[1], y = it->v[3];
+  double w = it->v[2];
+  double height = m_height + 2 * offset;
+  // Draw the outline.
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_rectangle(c->ctx, x, y, w, height);
+  cairo_stroke(c->ctx);
+  if (it->flags & HOVER) {
+    // Draw inside accent and the cursor if mouse is inside.
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+    cairo_rectangle(c->ctx, x+2, y+2, w-4, height-4);
+    cairo_stroke(c->ctx);
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+    cairo_move_to(c->ctx, x+offset+it->v[0], y+offset);
+    cairo_rel_line_to(c->ctx, 0, m_height);
+    cairo_stroke(c->ctx);
+  }
+  // Only the part of the text that fits was recorded; clip glyphs that
+  // stick out.
+  cairo_save(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, x+offset, y+2, w-2*offset, height-4);
+  cairo_clip(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  show_text(c, x+offset, y+offset+m_height, text);
+  cairo_restore(c->ctx);
+}
+
+// Number of bytes in the UTF-8 sequence that starts with “b”.
+static ptrdiff_t utf8_len(unsigned char b)
+{
+  if (b >= 0xf0) {
+    return 4;
+  } else if (b >= 0xe0) {
+    return 3;
+  } else if (b >= 0xc0) {
+    return 2;
+  }
+  return 1;
+}
+
+#define UTF8_CONT(b) (((unsigned char)(b) & 0xc0) == 0x80)
+
+// Length of the text in an edit box.
+static ptrdiff_t edit_len(const GUI_editstate *s)
+{
+  return s->size - (s->gapend - s->gap);
+}
+
+// Byte “k” of the text in an edit box.
+static char edit_byte(const GUI_editstate *s, ptrdiff_t k)
+{
+  return s->data[k < s->gap ? k : k + s->gapend - s->gap];
+}
+
+// Width of the text after the gap.
+static double edit_after(const GUI_editstate *s)
+{
+  return s->gapend < s->size ? s->x[s->gapend] : 0.0;
+}
+
+// Offset of byte “k” from the start of the text.
+static double edit_x(const GUI_editstate *s, ptrdiff_t k)
+{
+  if (k < s->gap) {
+    return s->x[k];
+  }
+  double total = s->before + edit_after(s);
+  k += s->gapend - s->gap;
+  return k < s->size ? total - s->x[k] : total;
+}
+
+// First position where the offset is at least (above = false) or more than
+// (above = true) “x”, or the length plus one if there is none. Offsets never
+// decrease, so this is a binary search.
+static ptrdiff_t edit_find(const GUI_editstate *s, double x, bool above)
+{
+  ptrdiff_t lo = 0, hi = edit_len(s) + 1;
+  while (lo < hi) {
+    ptrdiff_t mid = lo + (hi - lo) / 2;
+    double mx = edit_x(s, mid);
+    if (above ? mx > x : mx >= x) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// Make room for at least “n” bytes and a terminating 0 in the gap.
+// “c” is 0 outside of a frame.
+static bool edit_grow(GUI_context *c, GUI_editstate *s, ptrdiff_t n)
+{
+  if (s->gapend - s->gap > n) {
+    return true;
   }
-  // Draw the number
-  char buf[20];
-  snprintf(buf, 19, "%d", *state);
+  ptrdiff_t size = s->size ? 2 * s->size : 64;
+  while (size - edit_len(s) <= n) {
+    size *= 2;
+  }
+  char *data = realloc(s->data, size);
+  if (data == 0) {
+    return false;
+  }
+  s->data = data;
+  double *x = realloc(s->x, size * sizeof(double));
+  if (x == 0) {
+    return false;
+  }
+  s->x = x;
+  if (c != 0) {
+    count_alloc(c);
+  }
+  // The offsets after the gap are from the end, so they stay valid.
+  ptrdiff_t tail = s->size - s->gapend;
+  memmove(s->data + size - tail, s->data + s->gapend, tail);
+  memmove(s->x + size - tail, s->x + s->gapend, tail * sizeof(double));
+  s->gapend = size - tail;
+  s->size = size;
+  return true;
+}
+
+// Move the cursor one character to the left.
+static void edit_left(GUI_editstate *s)
+{
+  ptrdiff_t n = 1;
+  while (n < s->gap && n < 4 && UTF8_CONT(s->data[s->gap - n])) {
+    n++;
+  }
+  double w = s->before - s->x[s->gap - n];
+  double after = edit_after(s);
+  s->gap -= n;
+  s->gapend -= n;
+  memmove(s->data + s->gapend, s->data + s->gap, n);
+  s->x[s->gapend] = after + w;
+  for (ptrdiff_t k = 1; k < n; k++) {
+    s->x[s->gapend + k] = after;
+  }
+  s->before -= w;
+}
+
+// Number of bytes in the character after the cursor.
+static ptrdiff_t edit_next(const GUI_editstate *s)
+{
+  ptrdiff_t n = 1, max = utf8_len(s->data[s->gapend]);
+  while (n < max && s->gapend + n < s->size &&
+         UTF8_CONT(s->data[s->gapend + n])) {
+    n++;
+  }
+  return n;
+}
+
+// Move the cursor one character to the right.
+static void edit_right(GUI_editstate *s)
+{
+  ptrdiff_t n = edit_next(s);
+  double rest = s->gapend + n < s->size ? s->x[s->gapend + n] : 0.0;
+  double w = s->x[s->gapend] - rest;
+  memmove(s->data + s->gap, s->data + s->gapend, n);
+  s->x[s->gap] = s->before;
+  for (ptrdiff_t k = 1; k < n; k++) {
+    s->x[s->gap + k] = s->before + w;
+  }
+  s->before += w;
+  s->gap += n;
+  s->gapend += n;
+}
+
+// Insert a character of “n” bytes at the cursor.
+static bool edit_insert(GUI_context *c, GUI_editstate *s, const char *ch,
+                        ptrdiff_t n)
+{
+  if (edit_grow(c, s, n) == false) {
+    return false;
+  }
+  char str[5] = {0};
+  memcpy(str, ch, n);
   cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, buf, &ext);
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_move_to(c->ctx, x+offset, y+offset+ext.height);
-  cairo_show_text(c->ctx, buf);
-  return rv;
+  text_extents(c, str, &ext);
+  memcpy(s->data + s->gap, ch, n);
+  s->x[s->gap] = s->before;
+  for (ptrdiff_t k = 1; k < n; k++) {
+    s->x[s->gap + k] = s->before + ext.x_advance;
+  }
+  s->before += ext.x_advance;
+  s->gap += n;
+  return true;
+}
+
+bool gui_edit_set(GUI_editstate *state, const char *text)
+{
+  assert(state);
+  assert(text);
+  ptrdiff_t len = strlen(text);
+  state->gap = 0;
+  state->gapend = state->size;
+  state->before = 0.0;
+  state->displaypos = 0;
+  if (edit_grow(0, state, len) == false) {
+    return false;
+  }
+  memcpy(state->data, text, len);
+  state->gap = len;
+  state->measure = true;
+  return true;
+}
+
+const char *gui_edit_text(GUI_editstate *state)
+{
+  assert(state);
+  if (state->size == 0) {
+    return "";
+  }
+  while (state->gapend < state->size) {
+    edit_right(state);
+  }
+  state->data[state->gap] = 0;
+  return state->data;
+}
+
+void gui_edit_free(GUI_editstate *state)
+{
+  assert(state);
+  free(state->data);
+  free(state->x);
+  memset(state, 0, sizeof(GUI_editstate));
 }
 
 bool gui_editbox(GUI_context *c, const double x, const double y, const double w,
                  GUI_editstate *state)
 {
   assert(c);
+  Uint64 start = prof_start(c);
   assert(state);
   int32_t id = c->counter++;
   const double offset = 6.0;
   double height = m_height + 2 * offset;
+  double inner = w - 2 * offset;
   bool rv = false;
-  // Draw the outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, w, height);
-  cairo_stroke(c->ctx);
-  if ((c->mouse_x >= x && (c->mouse_x - x) <= w &&
-      c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
-    c->id = id;
-    // Draw inside accent if mouse is inside.
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+2, y+2, w-4, height-4);
-    cairo_stroke(c->ctx);
+  int32_t flags = 0;
+  if (state->measure) {
+    // Measure the text of gui_edit_set once; it is all before the gap.
+    ptrdiff_t len = state->gap;
+    state->gap = 0;
+    state->before = 0.0;
+    while (state->gap < len) {
+      ptrdiff_t n = utf8_len(state->data[state->gap]);
+      n = n < len - state->gap ? n : len - state->gap;
+      char str[5] = {0};
+      memcpy(str, state->data + state->gap, n);
+      cairo_text_extents_t ext;
+      text_extents(c, str, &ext);
+      state->x[state->gap] = state->before;
+      for (ptrdiff_t k = 1; k < n; k++) {
+        state->x[state->gap + k] = state->before + ext.x_advance;
+      }
+      state->before += ext.x_advance;
+      state->gap += n;
+    }
+    state->measure = false;
+  }
+  bool inside = c->mouse_x >= x && (c->mouse_x - x) <= w &&
+                c->mouse_y >= y && (c->mouse_y - y) <= height;
+  if (take_focus(c, id, inside, &state->hovered, &state->focus)) {
+    flags = HOVER;
+  }
+  if (state->focus) {
+    // Insert typed text, a character at a time.
+    const char *t = c->textinput;
+    while (*t) {
+      ptrdiff_t n = utf8_len(*t);
+      ptrdiff_t k = 1;
+      while (k < n && UTF8_CONT(t[k])) {
+        k++;
+      }
+      if (edit_insert(c, state, t, k) == false) {
+        break;
+      }
+      t += k;
+      rv = true;
+    }
     // Process keys
     if (c->keycode == SDLK_LEFT) { // move cursor left
-      if (state->cursorpos > 0) {
-        state->cursorpos--;
+      if (state->gap > 0) {
+        edit_left(state);
       }
     } else if (c->keycode == SDLK_RIGHT) { // move cursor right
-      if (state->cursorpos < state->used) {
-        state->cursorpos++;
-      }
-    } else if (c->keycode >= 0x20 && c->keycode <= 0x7e) { // insert regular key.
-      char keycode = (char)c->keycode;
-      if (c->mod & (SDL_KMOD_SHIFT|SDL_KMOD_CAPS)) {  // Handle capitals.
-        keycode -= 32;
-      }
-      if (state->cursorpos == state->used) {  // cursor at end
-        state->data[state->used++] = keycode;
-        state->cursorpos++;
-      } else if (state->cursorpos < state->used) {  // cursor inside text
-        for (int m = state->used; m >= state->cursorpos; m--) {
-          state->data[m+1] = state->data[m];
-        }
-        state->data[state->cursorpos++] = keycode;
-        state->used++;
-
+      if (state->gapend < state->size) {
+        edit_right(state);
       }
     } else if (c->keycode == SDLK_END) {
-      state->cursorpos = state->used;
+      while (state->gapend < state->size) {
+        edit_right(state);
+      }
     } else if (c->keycode == SDLK_HOME) {
-      state->cursorpos = 0;
+      while (state->gap > 0) {
+        edit_left(state);
+      }
     } else if (c->keycode == SDLK_BACKSPACE) {
-      if (state->cursorpos > 0 && state->cursorpos <= state->used) {
-        for (int move = state->cursorpos-1; move < state->used; move++) {
-          state->data[move] = state->data[move+1];
-        }
-        state->data[state->used--] = 0;
-        state->cursorpos--;
+      if (state->gap > 0) {
+        edit_left(state);
+        state->gapend += edit_next(state);
+        rv = true;
       }
     } else if (c->keycode == SDLK_DELETE) {
-      if (state->cursorpos >= 0 && state->cursorpos <= state->used) {
-        for (int move = state->cursorpos; move < state->used; move++) {
-          state->data[move] = state->data[move+1];
-        }
-        state->data[state->used--] = 0;
-        if (state->cursorpos > 0) {
-          state->cursorpos--;
-        }
+      if (state->gapend < state->size) {
+        state->gapend += edit_next(state);
+        rv = true;
       }
     }
-    // fill the cumulative offset array
-    double cum_off = 0.0;
-    for (int j = 0; j < state->cursorpos; j++) {
-      char str[2] = {0};
-       cairo_text_extents_t ext;
-      str[0] = state->data[j];
-      cairo_text_extents(c->ctx, str, &ext);
-      cum_off += ext.x_advance;
+  }
+  // Scroll horizontally to keep the cursor in view.
+  ptrdiff_t len = edit_len(state);
+  if (state->displaypos > state->gap) {
+    state->displaypos = state->gap;
+  }
+  double left = edit_x(state, state->displaypos);
+  double total = edit_x(state, len);
+  if (state->before - left > inner || (left > 0.0 && total - left < inner)) {
+    // Also scroll back when text at the end was deleted.
+    double want = state->before - left > inner ? state->before : total;
+    state->displaypos = edit_find(state, want - inner, false);
+    while (state->displaypos < len &&
+           UTF8_CONT(edit_byte(state, state->displaypos))) {
+      state->displaypos++;
     }
-    // TODO: draw the cursor position
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_move_to(c->ctx, x+offset+cum_off, y+offset);
-    cairo_rel_line_to(c->ctx, 0, m_height);
-    cairo_stroke(c->ctx);
+    left = edit_x(state, state->displaypos);
   }
-  // TODO: Draw the text, clip if longer than window.
-  cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, state->data, &ext);
+  // Record only the characters that fit.
+  ptrdiff_t end = edit_find(state, left + inner, true) - 1;
+  end = end > state->displaypos ? end : state->displaypos;
+  ptrdiff_t gap = state->gap;
+  ptrdiff_t a = state->displaypos, b = end < gap ? end : gap;
+  GUI_item *it = record(c, ITEM_EDITBOX, x, y, w, height, 0, 0);
+  if (it != 0) {
+    // The text that is shown can be on both sides of the gap.
+    GUI_list *l = &c->list[c->cur];
+    it->text = l->ntext;
+    if ((b > a && add_text(c, state->data + a, b - a) < 0) ||
+        (end > gap && add_text(c, state->data + state->gapend,
+                               end - gap) < 0) ||
+        add_text(c, "", 1) < 0) {
+      l->nitems--;
+      it = 0;
+    }
+  }
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = state->before - left;
+    it->v[1] = x;
+    it->v[2] = w;
+    it->v[3] = y;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return rv;
+}
+
+#define LIST_PAD 4.0   // Around the name in a row.
+#define LIST_BAR 6.0   // Width of the scroll bar.
+#define LIST_TYPED 1000000000  // Type-ahead starts over after 1 s.
+
+static void paint_listbox(GUI_context *c, const GUI_item *it, const char *text)
+{
+  double line = m_height + 2 * LIST_PAD;
+  int32_t rows = lround((it->h - 2) / line);
+  int32_t top = it->v[0], selected = it->v[1], hover = it->v[2];
+  int32_t count = it->v[3];
+  int32_t shown = count - top < rows ? count - top : rows;
+  double x = it->x, y = it->y + 1;
+  double w = it->w - (count > rows ? LIST_BAR + 2 : 0);
+  // Draw the outline.
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_move_to(c->ctx, x+offset, y+offset+ext.height);
-  cairo_show_text(c->ctx, state->data);
+  cairo_rectangle(c->ctx, it->x, it->y, it->w, it->h);
+  cairo_stroke(c->ctx);
+  // Draw the rows; names that are too long are clipped.
+  cairo_save(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, x + 1, y, w - 2, it->h - 2);
+  cairo_clip(c->ctx);
+  for (int32_t k = 0; k < shown; k++) {
+    double ry = y + k * line;
+    if (top + k == selected) {
+      cairo_new_path(c->ctx);
+      cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+      cairo_rectangle(c->ctx, x + 1, ry, w - 2, line);
+      cairo_fill(c->ctx);
+      cairo_set_source_rgb(c->ctx, c->bg.r, c->bg.g, c->bg.b);
+    } else {
+      cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+    }
+    show_text(c, x + 1 + LIST_PAD, ry + LIST_PAD + m_height, text);
+    text += strlen(text) + 1;
+    if (k == hover && (it->flags & HOVER)) {
+      cairo_new_path(c->ctx);
+      cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+      cairo_rectangle(c->ctx, x + 3, ry + 2, w - 6, line - 4);
+      cairo_stroke(c->ctx);
+    }
+  }
+  cairo_restore(c->ctx);
+  // Draw the scroll bar.
+  if (count > rows) {
+    double track = it->h - 4;
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+    cairo_rectangle(c->ctx, it->x + it->w - LIST_BAR - 2,
+                    it->y + 2 + track * top / count, LIST_BAR,
+                    fmax(track * rows / count, 4.0));
+    cairo_fill(c->ctx);
+  }
+}
 
-  return rv;
+typedef struct {
+  const char *name;
+  int32_t index;
+} List_entry;
+
+static int compare_entries(const void *a, const void *b)
+{
+  return SDL_strcasecmp(((const List_entry*)a)->name,
+                    ((const List_entry*)b)->name);
+}
+
+bool gui_listbox_index(GUI_liststate *state, const int32_t count,
+                       GUI_listname name, void *data)
+{
+  assert(state);
+  assert(name);
+  List_entry *entries = malloc((count > 0 ? count : 1) * sizeof(List_entry));
+  int32_t *order = realloc(state->order,
+                           (count > 0 ? count : 1) * sizeof(int32_t));
+  if (entries == 0 || order == 0) {
+    free(entries);
+    free(order);
+    state->order = 0;
+    state->norder = 0;
+    return false;
+  }
+  for (int32_t k = 0; k < count; k++) {
+    entries[k].name = name(data, k);
+    entries[k].index = k;
+  }
+  qsort(entries, count, sizeof(List_entry), compare_entries);
+  for (int32_t k = 0; k < count; k++) {
+    order[k] = entries[k].index;
+  }
+  free(entries);
+  state->order = order;
+  state->norder = count;
+  return true;
+}
+
+void gui_listbox_free(GUI_liststate *state)
+{
+  assert(state);
+  free(state->order);
+  state->order = 0;
+  state->norder = 0;
+}
+
+// Find the first item in the index that starts with “prefix”, ignoring
+// case, with a binary search. Returns -1 if there is none.
+static int32_t list_find(const GUI_liststate *state, GUI_listname name,
+                         void *data, const char *prefix)
+{
+  int32_t lo = 0, hi = state->norder;
+  while (lo < hi) {
+    int32_t mid = lo + (hi - lo) / 2;
+    if (SDL_strcasecmp(name(data, state->order[mid]), prefix) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < state->norder && SDL_strncasecmp(name(data, state->order[lo]),
+                                            prefix, strlen(prefix)) == 0) {
+    return state->order[lo];
+  }
+  return -1;
+}
+
+bool gui_listbox(GUI_context *c, const double x, const double y,
+                 const double w, const int32_t rows, const int32_t count,
+                 GUI_listname name, void *data, GUI_liststate *state)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  assert(rows > 0);
+  assert(name);
+  assert(state);
+  int32_t id = c->counter++;
+  double line = m_height + 2 * LIST_PAD;
+  double height = rows * line + 2;
+  int32_t old = state->selected;
+  int32_t flags = 0;
+  int32_t hover = -1;
+  bool follow = false;  // Scroll to the selection.
+  if (state->selected >= count) {
+    state->selected = count - 1;
+  }
+  bool inside = c->mouse_x >= x && (c->mouse_x - x) <= w &&
+                c->mouse_y >= y && (c->mouse_y - y) <= height;
+  if (take_focus(c, id, inside, &state->hovered, &state->focus)) {
+    flags = HOVER;
+    if (c->mouse_x >= x && c->mouse_x - x <= w && c->mouse_y > y &&
+        c->mouse_y - y < height - 1) {
+      hover = (c->mouse_y - y - 1) / line;
+      if (state->top + hover >= count) {
+        hover = -1;
+      } else if (c->button_released) {
+        state->selected = state->top + hover;
+      }
+    }
+    // Scroll with the wheel, without moving the selection.
+    state->top -= 3 * c->wheel;
+    // Process keys
+    int32_t sel = state->selected;
+    if (c->keycode == SDLK_UP) {
+      sel = sel > 0 ? sel - 1 : 0;
+    } else if (c->keycode == SDLK_DOWN) {
+      sel++;
+    } else if (c->keycode == SDLK_PAGEUP) {
+      sel -= rows;
+    } else if (c->keycode == SDLK_PAGEDOWN) {
+      sel = (sel < 0 ? 0 : sel) + rows;
+    } else if (c->keycode == SDLK_HOME) {
+      sel = 0;
+    } else if (c->keycode == SDLK_END) {
+      sel = count - 1;
+    }
+    if (sel != state->selected) {
+      state->selected = sel < 0 ? 0 : (sel >= count ? count - 1 : sel);
+      follow = true;
+    }
+    // Type-ahead; select the first name that starts with what was typed.
+    if (state->focus && c->textinput[0] != 0) {
+      Uint64 now = SDL_GetTicksNS();
+      size_t used = strlen(state->typed);
+      if (now - state->typed_ns > LIST_TYPED) {
+        used = 0;
+      }
+      size_t len = strlen(c->textinput);
+      if (used + len < sizeof(state->typed)) {
+        memcpy(state->typed + used, c->textinput, len + 1);
+      }
+      state->typed_ns = now;
+      int32_t found = list_find(state, name, data, state->typed);
+      if (found >= 0) {
+        state->selected = found;
+        follow = true;
+      }
+    }
+  }
+  if (follow && state->selected >= 0) {
+    if (state->selected < state->top) {
+      state->top = state->selected;
+    } else if (state->selected >= state->top + rows) {
+      state->top = state->selected - rows + 1;
+    }
+  }
+  if (state->top > count - rows) {
+    state->top = count - rows;
+  }
+  if (state->top < 0) {
+    state->top = 0;
+  }
+  // Only the names of the rows that are shown are fetched and recorded.
+  int32_t shown = count - state->top < rows ? count - state->top : rows;
+  GUI_item *it = record(c, ITEM_LISTBOX, x, y, w, height, 0, 0);
+  if (it != 0) {
+    GUI_list *l = &c->list[c->cur];
+    it->text = l->ntext;
+    for (int32_t k = 0; k < shown; k++) {
+      const char *text = name(data, state->top + k);
+      if (add_text(c, text, strlen(text) + 1) < 0) {
+        l->nitems--;
+        it = 0;
+        break;
+      }
+    }
+  }
+  if (it != 0) {
+    it->flags = flags;
+    it->v[0] = state->top;
+    it->v[1] = state->selected;
+    it->v[2] = hover;
+    it->v[3] = count;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return state->selected != old;
+}
+
+static void paint_image(GUI_context *c, const GUI_item *it)
+{
+  // A single blit of the surface that gui_image made for this size.
+  if (it->surface != 0) {
+    cairo_new_path(c->ctx);
+    cairo_set_source_surface(c->ctx, it->surface, it->x, it->y);
+    cairo_rectangle(c->ctx, it->x, it->y, it->w, it->h);
+    cairo_fill(c->ctx);
+  }
+}
+
+static void image_drop(struct GUI_images *im, Image_entry *e)
+{
+  if (e->surface != 0) {
+    cairo_surface_destroy(e->surface);
+  }
+  free(e->path);
+  im->bytes -= e->bytes;
+  memset(e, 0, sizeof(Image_entry));
+}
+
+// Find the entry of “path” with a surface of w×h, or of any size if w is
+// negative. Returns 0 if there is none.
+static Image_entry *image_find(struct GUI_images *im, uint64_t key,
+                               const char *path, int32_t w, int32_t h)
+{
+  for (int k = 0; k < IMAGE_CACHE; k++) {
+    Image_entry *e = &im->e[k];
+    if (e->path != 0 && e->key == key && e->stale == false &&
+        (w < 0 || (e->w == w && e->h == h)) && strcmp(e->path, path) == 0) {
+      return e;
+    }
+  }
+  return 0;
+}
+
+// Add a surface of “path” to the cache, and drop the least recently used
+// images that are not shown in this frame until it fits. Takes over the
+// surface; it is destroyed if there is no room. Returns the entry, or 0.
+static Image_entry *image_add(GUI_context *c, uint64_t key, const char *path,
+                              cairo_surface_t *surface, int32_t nw, int32_t nh)
+{
+  struct GUI_images *im = c->images;
+  ptrdiff_t limit = c->image_limit > 0 ? c->image_limit : GUI_IMAGELIMIT;
+  ptrdiff_t bytes = 0;
+  if (surface != 0) {
+    bytes = (ptrdiff_t)cairo_image_surface_get_stride(surface) *
+            cairo_image_surface_get_height(surface);
+  }
+  Image_entry *slot = 0;
+  while (true) {
+    Image_entry *victim = 0;
+    slot = 0;
+    for (int k = 0; k < IMAGE_CACHE; k++) {
+      Image_entry *e = &im->e[k];
+      if (e->path == 0) {
+        slot = e;
+      } else if (e->frame != im->frame &&
+                 (victim == 0 || e->used < victim->used)) {
+        victim = e;
+      }
+    }
+    if (victim == 0 || (slot != 0 && im->bytes + bytes <= limit)) {
+      break;
+    }
+    image_drop(im, victim);
+  }
+  char *copy = 0;
+  if (slot != 0) {
+    size_t len = strlen(path) + 1;
+    copy = malloc(len);
+    count_alloc(c);
+    if (copy != 0) {
+      memcpy(copy, path, len);
+    }
+  }
+  if (copy == 0) {
+    if (surface != 0) {
+      cairo_surface_destroy(surface);
+    }
+    return 0;
+  }
+  *slot = (Image_entry) {
+    .key = key, .path = copy, .nw = nw, .nh = nh,
+    .used = im->clock, .frame = im->frame, .serial = ++im->serial,
+    .bytes = bytes, .surface = surface,
+  };
+  if (surface != 0) {
+    slot->w = cairo_image_surface_get_width(surface);
+    slot->h = cairo_image_surface_get_height(surface);
+  }
+  im->bytes += bytes;
+  return slot;
+}
+
+// Decode “path”. A file that cannot be read gets an entry without a
+// surface, so that it is not tried again every frame.
+static Image_entry *image_decode(GUI_context *c, uint64_t key,
+                                 const char *path)
+{
+  cairo_surface_t *png = cairo_image_surface_create_from_png(path);
+  count_alloc(c);
+  if (cairo_surface_status(png) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(png);
+    return image_add(c, key, path, 0, 0, 0);
+  }
+  return image_add(c, key, path, png, cairo_image_surface_get_width(png),
+                   cairo_image_surface_get_height(png));
+}
+
+// Scale the decoded image in “src” to w×h.
+static Image_entry *image_scale(GUI_context *c, const Image_entry *src,
+                                int32_t w, int32_t h)
+{
+  cairo_surface_t *scaled = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                       w, h);
+  count_alloc(c);
+  if (cairo_surface_status(scaled) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(scaled);
+    return 0;
+  }
+  cairo_t *cr = cairo_create(scaled);
+  cairo_scale(cr, (double)w / src->w, (double)h / src->h);
+  cairo_set_source_surface(cr, src->surface, 0, 0);
+  // Pad, so that the edges are not blended with transparency.
+  cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_flush(scaled);
+  return image_add(c, src->key, src->path, scaled, src->nw, src->nh);
+}
+
+bool gui_image(GUI_context *c, const double x, const double y, const double w,
+               const double h, const char *path)
+{
+  assert(c);
+  Uint64 start = prof_start(c);
+  assert(path);
+  if (c->images == 0) {
+    c->images = calloc(1, sizeof(struct GUI_images));
+    count_alloc(c);
+    if (c->images == 0) {
+      return false;
+    }
+  }
+  struct GUI_images *im = c->images;
+  im->clock++;
+  uint64_t key = hash(14695981039346656037u, path, strlen(path));
+  // Forgotten entries can go once they are no longer shown.
+  for (int k = 0; k < IMAGE_CACHE; k++) {
+    Image_entry *e = &im->e[k];
+    if (e->stale && e->frame != im->frame) {
+      image_drop(im, e);
+    }
+  }
+  Image_entry *any = image_find(im, key, path, -1, -1);
+  if (any == 0) {
+    any = image_decode(c, key, path);
+  }
+  if (any == 0 || any->surface == 0) {
+    return false;
+  }
+  // Missing sizes follow from the aspect ratio of the file.
+  int32_t iw = lround(w), ih = lround(h);
+  if (iw <= 0 && ih <= 0) {
+    iw = any->nw;
+    ih = any->nh;
+  } else if (iw <= 0) {
+    iw = lround((double)ih * any->nw / any->nh);
+  } else if (ih <= 0) {
+    ih = lround((double)iw * any->nh / any->nw);
+  }
+  iw = iw > 0 ? iw : 1;
+  ih = ih > 0 ? ih : 1;
+  Image_entry *e = image_find(im, key, path, iw, ih);
+  if (e == 0) {
+    // Scale from the decoded file, which is decoded again only if it was
+    // dropped from the cache.
+    Image_entry *src = image_find(im, key, path, any->nw, any->nh);
+    if (src == 0) {
+      src = image_decode(c, key, path);
+    }
+    if (src == 0 || src->surface == 0) {
+      return false;
+    }
+    src->used = im->clock;
+    src->frame = im->frame;
+    e = image_scale(c, src, iw, ih);
+    if (e == 0) {
+      return false;
+    }
+  }
+  e->used = im->clock;
+  e->frame = im->frame;
+  GUI_item *it = record(c, ITEM_IMAGE, x, y, iw, ih, 0, 0);
+  if (it != 0) {
+    it->v[0] = e->serial;
+    it->v[1] = key >> 32;
+    it->v[2] = key & 0xffffffffu;
+    it->surface = e->surface;
+  }
+  seal(c, it);
+  prof_stop(c, start);
+  return true;
+}
+
+void gui_image_forget(GUI_context *c, const char *path)
+{
+  assert(c);
+  for (int k = 0; c->images != 0 && k < IMAGE_CACHE; k++) {
+    Image_entry *e = &c->images->e[k];
+    if (e->path != 0 && (path == 0 || strcmp(e->path, path) == 0)) {
+      e->stale = true;
+    }
+  }
+}
+
+static void paint_panel(GUI_context *c, const GUI_item *it)
+{
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, it->x, it->y, it->w, it->h);
+  cairo_set_source_rgb(c->ctx, c->bg.r, c->bg.g, c->bg.b);
+  cairo_fill_preserve(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
+  cairo_stroke(c->ctx);
 }
 
+static void paint_item(GUI_context *c, const GUI_item *it, const char *text)
+{
+  switch (it->kind) {
+    case ITEM_BUTTON:
+      paint_button(c, it, text);
+      break;
+    case ITEM_LABEL:
+      paint_text(c, it->v[0], it->v[1], text);
+      break;
+    case ITEM_CHECKBOX:
+      paint_checkbox(c, it, text);
+      break;
+    case ITEM_RADIOBUTTONS:
+      paint_radiobuttons(c, it, text);
+      break;
+    case ITEM_COLORSAMPLE:
+      paint_colorsample(c, it);
+      break;
+    case ITEM_SLIDER:
+      paint_slider(c, it);
+      break;
+    case ITEM_SPINNER:
+      paint_spinner(c, it);
+      break;
+    case ITEM_EDITBOX:
+      paint_editbox(c, it, text);
+      break;
+    case ITEM_PANEL:
+      paint_panel(c, it);
+      break;
+    case ITEM_COLORWHEEL:
+      paint_colorwheel(c, it);
+      break;
+    case ITEM_LISTBOX:
+      paint_listbox(c, it, text);
+      break;
+    case ITEM_IMAGE:
+      paint_image(c, it);
+      break;
+    default:
+      break;
+  }
+}
@@ -5,7 +5,7 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-26 12:57:19 +0200
-// Last modified: 2025-09-26T22:33:15+0200
+// Last modified: 2026-10-24T12:03:19+0200
 
 // Simple immediate mode GUI for SDL3 and Cairo.
 
@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <SDL3/SDL.h>
 #include <cairo/cairo.h>
@@ -25,33 +26,133 @@ typedef struct {
   double b;
 } GUI_rgb;
 
+typedef struct {
+  double h;  // Hue in degrees, 0–360.
+  double s;  // Saturation, 0–1.
+  double v;  // Value, 0–1.
+} GUI_hsv;
+
+// A widget as drawn in a frame; an entry in the display list.
+typedef struct {
+  int32_t kind;
+  int32_t flags;
+  double x, y, w, h;  // Bounding box.
+  double v[4];        // Parameters; depends on the kind.
+  ptrdiff_t text;     // Offset of the text in the list, or -1.
+  uint64_t hash;      // Of all of the above, and the text.
+  cairo_surface_t *surface;  // Cached image painted in the widget, or 0.
+} GUI_item;
+
+typedef struct {
+  GUI_item *items;
+  ptrdiff_t nitems, maxitems;
+  char *text;         // Null-terminated strings used by the items.
+  ptrdiff_t ntext, maxtext;
+} GUI_list;
+
+#define GUI_MAXDAMAGE 16
+#define GUI_MAXWORKERS 16
+#define GUI_IMAGELIMIT (32 << 20)
+
 typedef struct {
   SDL_Renderer *renderer;
+  // The texture of the frame; from a pool, and often larger than the
+  // window. Replaced by gui_begin after the window was resized.
   SDL_Texture *texture;
+  struct GUI_textures *textures;
+  bool resized;
   cairo_surface_t *surface;
   cairo_t *ctx;
+  // The window is drawn on the canvas, which is kept between frames.
+  // Only the parts where the display list changed are redrawn, and uploaded
+  // to the texture.
+  unsigned char *canvas;
+  ptrdiff_t canvas_size;  // Allocated bytes.
+  int32_t width, height, stride;
+  GUI_list list[2];  // Of this frame and of the previous one.
+  int32_t cur;       // Index of the list of this frame.
+  uint64_t theme;    // Hash of the colors the canvas was drawn with.
+  bool full;         // Redraw the whole canvas.
+  SDL_Rect damage[GUI_MAXDAMAGE];
+  int32_t ndamage;
+  // Statistics of the last frame. With a render thread, the pixels and the
+  // allocations while painting are those of the frame presented last.
+  int64_t pixels;    // Pixels redrawn.
+  int64_t allocs;    // Allocations; zero when settled.
+  // Set before the first frame to draw in a render thread, so that the
+  // main thread can handle events meanwhile.
+  bool threaded;
+  struct GUI_render *render;
+  bool pending;      // The render thread is drawing a frame.
+  bool painting;     // Set while painting, in either thread.
+  int64_t paint_pixels, paint_allocs;
+  // Threads that help to paint large damaged areas, in tiles; at most
+  // GUI_MAXWORKERS. Set before the first frame.
+  int32_t workers;
+  struct GUI_pool *pool;
+  SDL_Mutex *textlock;  // Guards the text cache while painting tiles, or 0.
+  // Extents and glyphs of the texts that were drawn recently.
+  cairo_font_face_t *font;
+  struct GUI_textcache *texts;
+  struct GUI_wheels *wheels;  // Discs of color wheels.
+  // Decoded and scaled images, and the bytes they may use before the least
+  // recently used are dropped; 0 means GUI_IMAGELIMIT.
+  struct GUI_images *images;
+  ptrdiff_t image_limit;
   int32_t mouse_x, mouse_y;
   int32_t id;
   int32_t keycode;
+  char textinput[32];  // UTF-8 text typed since the last frame.
+  int32_t wheel;       // Mouse wheel steps since the last frame; up is +.
+  bool editing;        // An edit box has the focus, so keys are text.
   int32_t counter;
   int32_t maxid;
   int16_t mod;
   bool button_pressed;
   bool button_released;
+  bool dirty;   // The window needs to be redrawn.
+  bool hidden;  // The window is minimized or hidden; don't draw.
+  // Show frame time, latency and the most expensive widgets; toggled by F12.
+  bool hud;
+  struct GUI_profile *prof;
   GUI_rgb fg;
   GUI_rgb bg;
   GUI_rgb acc;
 } GUI_context;
 
-#define EBUF_SIZE 256
+// UTF-8 text of an edit box, in a gap buffer with the cursor at the gap, so
+// that typing and deleting take constant time however long the text is.
+// The widths of the characters are kept as offsets; before the gap from the
+// start of the text, after it from the end. A zeroed GUI_editstate is empty.
 typedef struct {
-  char data[EBUF_SIZE];
-//  double cum_off[EBUF_SIZE];
-  ptrdiff_t used;
-  ptrdiff_t cursorpos;
-  ptrdiff_t displaypos;
+  char *data;              // Text before the gap, the gap, text after it.
+  double *x;               // Offset of every byte in data.
+  ptrdiff_t size;          // Of data and x.
+  ptrdiff_t gap, gapend;   // The cursor is at gap.
+  double before;           // Width of the text before the gap.
+  ptrdiff_t displaypos;    // First byte that is shown.
+  bool measure;            // Set by gui_edit_set; widths are unknown.
+  bool hovered;            // Got the focus from the mouse, not from Tab.
+  bool focus;              // Clicked or reached with Tab; keys are text.
 } GUI_editstate;
 
+// Returns the name of item “index” of a list box.
+typedef const char *(*GUI_listname)(void *data, int32_t index);
+
+// Scroll position and selection of a list box, and an index of the names
+// sorted without regard to case for type-ahead search. A zeroed
+// GUI_liststate has the first item selected and no index.
+typedef struct {
+  int32_t selected;        // Or -1 for none.
+  int32_t top;             // First item that is shown.
+  int32_t *order;          // Items sorted by name, from gui_listbox_index.
+  int32_t norder;
+  char typed[32];          // For type-ahead.
+  Uint64 typed_ns;         // When a character was last typed.
+  bool hovered;            // Got the focus from the mouse, not from Tab.
+  bool focus;              // Clicked or reached with Tab; keys are text.
+} GUI_liststate;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -61,14 +162,41 @@ extern "C" {
 // This data should either be a global, or should be “static” in the function
 // that contains the GUI calls.
 
-// All calls to GUI elements and all Cairo calls should *only* be done between
-// gui_begin and gui_end;
-void gui_begin(SDL_Renderer *renderer, SDL_Texture *texture, GUI_context *out);
+// All calls to GUI elements should *only* be done between gui_begin and
+// gui_end. The widgets are drawn in gui_end, where they have changed.
+// So drawing with Cairo on ctx->ctx directly does not work reliably.
+// The context creates the textures it needs; gui_close destroys them, so
+// call it before destroying the renderer.
+void gui_begin(SDL_Renderer *renderer, GUI_context *out);
 void gui_end(GUI_context *ctx);
 
+// Instead of gui_begin, start a frame that is only drawn on the canvas, a
+// width×height cairo image surface in ctx->surface. Useful for benchmarks
+// and tests, since it needs neither SDL nor a display.
+void gui_begin_offscreen(int32_t width, int32_t height, GUI_context *out);
+
+// With a render thread (ctx->threaded), gui_end returns before the frame is
+// drawn. Returns true while it is still being drawn. Skip gui_begin…gui_end
+// while it is busy, since gui_begin waits for the render thread.
+bool gui_busy(GUI_context *ctx);
+
+// Release the memory used by the context.
+void gui_close(GUI_context *ctx);
+
 // Call this to process events in SDL_AppEvent.
+// Events that change what the GUI shows set ctx->dirty. Set it yourself for
+// other changes, and skip gui_begin…gui_end while it is false.
 SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event);
 
+// Write the input of a frame to “f”, as a line starting with “input”,
+// preceded by a “text” line if text was typed.
+// Call it before gui_begin. Returns false on a write error.
+bool gui_record(const GUI_context *ctx, FILE *f);
+
+// Set the input of a frame from the lines written by gui_record, instead of
+// from events. Returns true if the line completes the input of a frame.
+bool gui_replay(GUI_context *ctx, const char *line);
+
 // Theme helpers
 void gui_theme_light(GUI_context *ctx);
 void gui_theme_dark(GUI_context *ctx);
@@ -92,23 +220,72 @@ bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
 void gui_colorsample(GUI_context *c, const double x, const double y,
                      const double w, const double h, const GUI_rgb *state);
 
+// Pick a color on a hue/saturation disc “size” pixels across, with a value
+// bar to the right of it. Returns true if the color was changed.
+bool gui_colorwheel(GUI_context *c, const double x, const double y,
+                    const double size, GUI_hsv *state);
+// Convert between color models. Grays keep the hue that “out” had.
+void gui_hsv_to_rgb(const GUI_hsv *in, GUI_rgb *out);
+void gui_rgb_to_hsv(const GUI_rgb *in, GUI_hsv *out);
+
 // Show a slider. This can have a value between 0 and 255.
 // Returns true when the value has changed.
 // The value is written to the variable “state”
 bool gui_slider(GUI_context *c, const double x, const double y, int *state);
 
+// Track of a slider that shows a color ramp. The caller sets the colors at
+// both ends every frame; the ramp is only rendered again when they change.
+typedef struct {
+  GUI_rgb from, to;
+  double made[2];  // The colors it was rendered with, packed.
+  cairo_surface_t *surface;
+} GUI_gradient;
+
+// A slider that shows the color ramp of “track” under the thumb.
+bool gui_slider_gradient(GUI_context *c, const double x, const double y,
+                         int *state, GUI_gradient *track);
+void gui_gradient_free(GUI_gradient *track);
+
 bool gui_ispinner(GUI_context *c, const double x, const double y,
                  int32_t min, int32_t max, int32_t*state);
 
+// Click the box or reach it with Tab to type in it. Returns true if the
+// text was changed.
 bool gui_editbox(GUI_context *c, const double x, const double y, const double w,
                  GUI_editstate *state);
+// Replace the text of an edit box, and put the cursor at the end.
+bool gui_edit_set(GUI_editstate *state, const char *text);
+// Returns the text of an edit box. Valid until the box is used again.
+const char *gui_edit_text(GUI_editstate *state);
+void gui_edit_free(GUI_editstate *state);
+
+// Show “rows” rows of a list of “count” items, with a scroll bar if they do
+// not fit. Only the names of the rows that are shown are requested, so the
+// cost of a frame does not depend on “count”. Use the arrow keys, page up
+// and down, home and end or the mouse wheel to move. Once the list was
+// clicked or reached with Tab, typing selects the first name that starts
+// with the typed text. Returns true if the selection was changed.
+bool gui_listbox(GUI_context *c, const double x, const double y,
+                 const double w, const int32_t rows, const int32_t count,
+                 GUI_listname name, void *data, GUI_liststate *state);
+// Sort the names for type-ahead. Call it again when the names change.
+bool gui_listbox_index(GUI_liststate *state, const int32_t count,
+                       GUI_listname name, void *data);
+void gui_listbox_free(GUI_liststate *state);
+
+// Show the PNG file “path” at w×h pixels. If one of them is 0, it follows
+// from the aspect ratio of the image; if both are, the image is not scaled.
+// A file is decoded once and scaled once per size, and kept in a cache
+// limited by ctx->image_limit. Returns false if it could not be read.
+bool gui_image(GUI_context *c, const double x, const double y, const double w,
+               const double h, const char *path);
+// Read “path” again the next time it is shown, for instance when the file
+// was changed. If “path” is 0, all images are read again.
+void gui_image_forget(GUI_context *c, const char *path);
 
 // TODO:
 // * spinner
-// * edit field
-// * list box
 // * progress bar
-// * image
 //
 // Optional
 // * Add icons to buttons.
@@ -0,0 +1,84 @@
+// file: ipc.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-18 21:31:08 +0200
+// Last modified: 2026-10-20T12:06:37+0200
+
+#include "ipc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+void ipc_path(Sbuf *path)
+{
+  assert(path);
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir != 0) {
+    sbuf_printf(path, "%s/x-razer.sock", dir);
+  } else {
+    sbuf_printf(path, "/tmp/x-razer-%d.sock", (int)getuid());
+  }
+}
+
+int ipc_connect(void)
+{
+  Sbuf path = {0};
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  ipc_path(&path);
+  bool fits = path.error == false &&
+              path.used < (ptrdiff_t)sizeof(addr.sun_path);
+  if (fits) {
+    memcpy(addr.sun_path, path.data, path.used);
+  }
+  sbuf_free(&path);
+  if (fits == false) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ipc_request(int fd, const char *cmd, char *reply, size_t len)
+{
+  assert(cmd);
+  assert(reply);
+  assert(len > 0);
+  reply[0] = 0;
+  if (fd < 0) {
+    return false;
+  }
+  size_t cmdlen = strlen(cmd);
+  if (send(fd, cmd, cmdlen, MSG_NOSIGNAL) != (ssize_t)cmdlen ||
+      send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+    return false;
+  }
+  // Read up to and including the newline.
+  size_t used = 0;
+  while (used < len - 1) {
+    ssize_t n = recv(fd, reply + used, 1, 0);
+    if (n <= 0) {
+      reply[used] = 0;
+      return false;
+    }
+    if (reply[used] == '\n') {
+      break;
+    }
+    used++;
+  }
+  reply[used] = 0;
+  return strncmp(reply, "ok", 2) == 0;
+}
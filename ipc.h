@@ -0,0 +1,49 @@
+// file: ipc.h
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-18 21:31:08 +0200
+// Last modified: 2026-10-23T11:20:54+0200
+
+// Client side of the protocol spoken by x-razerd.
+//
+// Commands are single lines, terminated by a newline:
+//   color R G B   Set a static color.
+//   frame HEX     Set a per-key frame; rows×cols RGB triplets in hex.
+//   load          Load the color from ~/.x-razerrc.
+//   load NAME     Load a profile from ~/.x-razer-profiles.
+//   status        Query the state of the daemon.
+// Every command is answered by a single line starting with “ok” or “error”.
+// Commands that change the keyboard are answered with “error no keyboard”
+// if none is connected.
+// The status reply is “ok R G B perkey|global ID product name”, where ID
+// is the USB product ID in hex, or 0x0000 without a keyboard.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sbuf.h"
+
+#define IPC_LINE 1024
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Store the path of the socket in “path”.
+extern void ipc_path(Sbuf *path);
+
+// Connect to the daemon. Returns a socket, or -1 if it is not running.
+extern int ipc_connect(void);
+
+// Send “cmd” and wait for the reply, which is stored in “reply”.
+// Returns true if the reply starts with “ok”.
+extern bool ipc_request(int fd, const char *cmd, char *reply, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,34 @@
+// file: librazer.h
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-18 23:10:27 +0200
+// Last modified: 2026-10-23T10:48:17+0200
+
+// Public interface of librazer.
+//
+// Open a keyboard with usb_init, set a color with usb_set_color or a per-key
+// frame with usb_set_frame, and read information from the USB_data struct
+// or with usb_get_firmware and usb_get_serial. Close it with usb_close and
+// usb_exit. To talk to a running x-razerd instead, see ipc.h.
+//
+// After usb_init, none of these functions allocate memory themselves,
+// though libusb may per transfer. Functions that need a report buffer take
+// a USB_buffer from the caller.
+//
+// Additions keep the existing functions and structures backwards
+// compatible; an incompatible change increments LIBRAZER_VERSION, which is
+// also the major version of the shared library.
+
+#pragma once
+
+#define LIBRAZER_VERSION 1
+
+#include "razer-usb.h"
+#include "rc.h"
+#include "sbuf.h"
+#include "ipc.h"
+#include "metrics.h"
+#include "profile.h"
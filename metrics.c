@@ -0,0 +1,100 @@
+// file: metrics.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-19 09:12:40 +0200
+// Last modified: 2026-10-24T15:02:44+0200
+
+#include "metrics.h"
+#include "sbuf.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+Metrics razer_metrics;
+
+#define LOAD(name) \
+  (unsigned long long)atomic_load_explicit(&razer_metrics.name, memory_order_relaxed)
+
+static void metric(Sbuf *out, const char *program, const char *name,
+                   const char *type, const char *help, unsigned long long val)
+{
+  sbuf_printf(out, "# HELP x_razer_%s %s\n# TYPE x_razer_%s %s\n"
+              "x_razer_%s{program=\"%s\"} %llu\n",
+              name, help, name, type, name, program, val);
+}
+
+bool metrics_write(const char *path, const char *program)
+{
+  assert(path);
+  assert(program);
+  Sbuf out = {0};
+  metric(&out, program, "frames_rendered_total", "counter",
+         "GUI frames rendered.", LOAD(frames));
+  sbuf_printf(&out, "# HELP x_razer_frame_seconds_total Time spent rendering "
+              "GUI frames.\n# TYPE x_razer_frame_seconds_total counter\n"
+              "x_razer_frame_seconds_total{program=\"%s\"} %.6f\n",
+              program, LOAD(frame_ns) / 1e9);
+  metric(&out, program, "wakeups_total", "counter",
+         "GUI main loop iterations, with or without a redraw.", LOAD(wakeups));
+  metric(&out, program, "pixels_redrawn_total", "counter",
+         "GUI pixels redrawn and uploaded.", LOAD(pixels));
+  metric(&out, program, "gui_allocations_total", "counter",
+         "Allocations made by the GUI while drawing frames.",
+         LOAD(gui_allocs));
+  metric(&out, program, "usb_reports_sent_total", "counter",
+         "USB reports sent.", LOAD(usb_sent));
+  metric(&out, program, "usb_reports_failed_total", "counter",
+         "USB reports that failed.", LOAD(usb_failed));
+  metric(&out, program, "usb_reports_retried_total", "counter",
+         "USB reports that were retried.", LOAD(usb_retried));
+  metric(&out, program, "queue_depth", "gauge",
+         "Updates waiting to be sent to the keyboard.", LOAD(queue_depth));
+  metric(&out, program, "rc_reads_total", "counter",
+         "Reads of the RC file.", LOAD(rc_reads));
+  metric(&out, program, "rc_writes_total", "counter",
+         "Writes of the RC file.", LOAD(rc_writes));
+  metric(&out, program, "device_connects_total", "counter",
+         "Keyboards opened.", LOAD(connects));
+  metric(&out, program, "device_disconnects_total", "counter",
+         "Keyboards closed or unplugged.", LOAD(disconnects));
+  // Write to a temporary file and rename it, so a scraper never sees
+  // a partial file.
+  Sbuf tmp = {0};
+  sbuf_printf(&tmp, "%s.tmp", path);
+  FILE *f = 0;
+  if (out.error == false && tmp.error == false) {
+    f = fopen(tmp.data, "w");
+  }
+  bool ok = f != 0;
+  if (ok) {
+    ok = fwrite(out.data, 1, out.used, f) == (size_t)out.used;
+    ok = (fclose(f) == 0) && ok;
+    if (ok == false || rename(tmp.data, path) != 0) {
+      remove(tmp.data);
+      ok = false;
+    }
+  }
+  sbuf_free(&out);
+  sbuf_free(&tmp);
+  return ok;
+}
+
+void metrics_update(const char *program)
+{
+  static time_t last = 0;
+  const char *path = getenv("X_RAZER_METRICS");
+  if (path == 0 || *path == 0) {
+    return;
+  }
+  time_t now = time(0);
+  if (now - last < METRICS_INTERVAL) {
+    return;
+  }
+  last = now;
+  metrics_write(path, program);
+}
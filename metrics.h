@@ -0,0 +1,61 @@
+// file: metrics.h
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-19 09:12:40 +0200
+// Last modified: 2026-10-24T15:02:44+0200
+
+// Counters and gauges, exported in the Prometheus text format.
+// If the environment variable X_RAZER_METRICS names a file, it is rewritten
+// periodically. Point it into the textfile directory of node_exporter.
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Seconds between updates of the metrics file.
+#define METRICS_INTERVAL 10
+
+typedef struct {
+  atomic_uint_fast64_t frames;         // GUI frames rendered.
+  atomic_uint_fast64_t frame_ns;       // Total GUI frame time.
+  atomic_uint_fast64_t wakeups;        // GUI main loop iterations.
+  atomic_uint_fast64_t pixels;         // GUI pixels redrawn.
+  atomic_uint_fast64_t gui_allocs;     // GUI allocations while drawing.
+  atomic_uint_fast64_t usb_sent;       // USB reports sent.
+  atomic_uint_fast64_t usb_failed;     // USB reports that failed.
+  atomic_uint_fast64_t usb_retried;    // USB reports that were retried.
+  atomic_int_fast64_t queue_depth;     // Updates waiting to be sent.
+  atomic_uint_fast64_t rc_reads;       // Reads of the RC file.
+  atomic_uint_fast64_t rc_writes;      // Writes of the RC file.
+  atomic_uint_fast64_t connects;       // Keyboards opened.
+  atomic_uint_fast64_t disconnects;    // Keyboards closed or unplugged.
+} Metrics;
+
+#define METRIC_ADD(name, n) \
+  atomic_fetch_add_explicit(&razer_metrics.name, (n), memory_order_relaxed)
+#define METRIC_SET(name, n) \
+  atomic_store_explicit(&razer_metrics.name, (n), memory_order_relaxed)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Prefixed, since librazer exports it to the programs that link with it.
+extern Metrics razer_metrics;
+
+// Write all metrics to “path”, labeled with the name of the program.
+// The file is replaced atomically. Returns false on failure.
+extern bool metrics_write(const char *path, const char *program);
+
+// Write the metrics to $X_RAZER_METRICS, if it is set and the last update
+// was at least METRICS_INTERVAL seconds ago.
+extern void metrics_update(const char *program);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,434 @@
+// file: profile.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-19 13:05:44 +0200
+// Last modified: 2026-10-24T15:31:12+0200
+
+#define _POSIX_C_SOURCE 200809L
+#include "profile.h"
+#include "sbuf.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char magic[8] = "XRZPRF2";
+static const char *textname = "/.x-razer-profiles";
+static const char *indexname = "/.x-razer-profiles.idx";
+
+// Macro to skip whitespace in a string.
+#define SKIPWS(ptr) \
+  while (*(ptr) == ' ' || *(ptr) == '\t' || *(ptr) == '\r' || *(ptr) == '\n') {(ptr)++;}
+
+// Modification time of a file in ns; a whole second is too coarse to see
+// two edits apart.
+static int64_t mtime_ns(const struct stat *st)
+{
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// FNV-1a hash of a name.
+static uint32_t hash(const char *name)
+{
+  uint32_t h = 2166136261u;
+  for (; *name; name++) {
+    h = (h ^ (uint8_t)*name) * 16777619u;
+  }
+  return h;
+}
+
+// Parse “count” numbers between 0 and “max” from “cur”.
+static bool numbers(char *cur, int count, long max, long *out)
+{
+  for (int k = 0; k < count; k++) {
+    char *end;
+    SKIPWS(cur);
+    out[k] = strtol(cur, &end, 0);
+    if (end == cur || out[k] < 0 || out[k] > max) {
+      return false;
+    }
+    cur = end;
+  }
+  SKIPWS(cur);
+  return *cur == 0;
+}
+
+// Give the keys that were not set in a profile its base color.
+static void finish(Profile *prof, bool set[USB_MAXROWS][USB_MAXCOLS])
+{
+  for (int r = 0; r < USB_MAXROWS; r++) {
+    for (int c = 0; c < USB_MAXCOLS; c++) {
+      if (set[r][c] == false) {
+        memcpy(prof->keys[r][c], prof->color, 3);
+      }
+    }
+  }
+}
+
+// Parse the text file into an array of profiles, allocated with realloc.
+// Returns the number of profiles, or -1 on error.
+static int32_t parse(FILE *f, Profile **out, int *errline, const char **error)
+{
+  *error = "syntax error";
+  Profile *profs = 0;
+  int32_t count = 0, cap = 0;
+  bool set[USB_MAXROWS][USB_MAXCOLS] = {{0}};
+  char line[256];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), f) != 0) {
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment != 0) {
+      *comment = 0;
+    }
+    // Remove trailing whitespace.
+    size_t len = strlen(line);
+    while (len > 0 && strchr(" \t\r\n", line[len-1]) != 0) {
+      line[--len] = 0;
+    }
+    char *cur = line;
+    SKIPWS(cur);
+    if (*cur == 0) {
+      continue;
+    }
+    Profile *prof = count > 0 ? &profs[count-1] : 0;
+    long v[5];
+    if (*cur == '[') {
+      char *end = strchr(cur, ']');
+      if (end == 0 || end == cur + 1 || end - cur - 1 >= PROFILE_NAMELEN) {
+        goto error;
+      }
+      *end = 0;
+      for (int32_t k = 0; k < count; k++) {
+        if (strcmp(profs[k].name, cur + 1) == 0) {
+          *error = "duplicate profile name";
+          goto error;
+        }
+      }
+      if (prof != 0) {
+        finish(prof, set);
+      }
+      if (count == cap) {
+        cap = cap ? 2 * cap : 16;
+        Profile *n = realloc(profs, cap * sizeof(Profile));
+        if (n == 0) {
+          *error = "out of memory";
+          goto error;
+        }
+        profs = n;
+      }
+      prof = &profs[count++];
+      memset(prof, 0, sizeof(Profile));
+      memcpy(prof->name, cur + 1, end - cur - 1);
+      memset(set, 0, sizeof(set));
+    } else if (prof == 0) {
+      goto error;
+    } else if (strncmp(cur, "color", 5) == 0 && numbers(cur + 5, 3, 255, v)) {
+      prof->color[0] = v[0];
+      prof->color[1] = v[1];
+      prof->color[2] = v[2];
+    } else if (strncmp(cur, "effect", 6) == 0) {
+      cur += 6;
+      SKIPWS(cur);
+      if (strcmp(cur, "static") == 0) {
+        prof->effect = PROFILE_STATIC;
+      } else if (strcmp(cur, "keys") == 0) {
+        prof->effect = PROFILE_KEYS;
+      } else {
+        goto error;
+      }
+    } else if (strncmp(cur, "key", 3) == 0 && numbers(cur + 3, 5, 255, v) &&
+               v[0] < USB_MAXROWS && v[1] < USB_MAXCOLS) {
+      prof->keys[v[0]][v[1]][0] = v[2];
+      prof->keys[v[0]][v[1]][1] = v[3];
+      prof->keys[v[0]][v[1]][2] = v[4];
+      set[v[0]][v[1]] = true;
+    } else if (strncmp(cur, "device", 6) == 0) {
+      // The product ID is followed by a color.
+      char *end;
+      cur += 6;
+      if (prof->ndevices == PROFILE_DEVICES) {
+        *error = "too many device overrides";
+        goto error;
+      }
+      long id = strtol(cur, &end, 0);
+      if (end == cur || id < 0 || id > 0xffff || numbers(end, 3, 255, v) == false) {
+        goto error;
+      }
+      Profile_device *dev = &prof->devices[prof->ndevices++];
+      dev->product_id = id;
+      dev->color[0] = v[0];
+      dev->color[1] = v[1];
+      dev->color[2] = v[2];
+    } else {
+      goto error;
+    }
+  }
+  if (count > 0) {
+    finish(&profs[count-1], set);
+  }
+  *out = profs;
+  return count;
+error:
+  free(profs);
+  *errline = lineno;
+  return -1;
+}
+
+bool profiles_compile(const char *text, const char *index, int *errline,
+                      const char **error)
+{
+  assert(text);
+  assert(index);
+  assert(errline);
+  assert(error);
+  *errline = 0;
+  *error = 0;
+  FILE *f = fopen(text, "r");
+  if (f == 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0) {
+    fclose(f);
+    return false;
+  }
+  Profile *profs = 0;
+  int32_t count = parse(f, &profs, errline, error);
+  fclose(f);
+  if (count < 0) {
+    return false;
+  }
+  // Keep the hash table at most half full.
+  uint32_t nslots = 16;
+  while (nslots < 2 * (uint32_t)count) {
+    nslots *= 2;
+  }
+  uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+  if (slots == 0) {
+    free(profs);
+    return false;
+  }
+  for (int32_t k = 0; k < count; k++) {
+    uint32_t s = hash(profs[k].name) & (nslots - 1);
+    while (slots[s] != 0) { // parse() rejects duplicate names.
+      s = (s + 1) & (nslots - 1);
+    }
+    slots[s] = k + 1;
+  }
+  Profile_header header = {
+    .count = count,
+    .nslots = nslots,
+    .mtime_ns = mtime_ns(&st),
+    .size = st.st_size,
+    .inode = st.st_ino,
+  };
+  memcpy(header.magic, magic, sizeof(magic));
+  // Write to a temporary file and rename it, so that a process that has
+  // mapped the old index is not affected. The name is unique, so that
+  // processes that compile at the same time don't write the same file.
+  Sbuf tmp = {0};
+  sbuf_printf(&tmp, "%s.XXXXXX", index);
+  int fd = tmp.error ? -1 : mkstemp(tmp.data);
+  FILE *out = fd < 0 ? 0 : fdopen(fd, "w");
+  if (fd >= 0 && out == 0) {
+    close(fd);
+    remove(tmp.data);
+  }
+  bool ok = out != 0;
+  if (ok) {
+    ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(slots, sizeof(uint32_t), nslots, out) == nslots &&
+         fwrite(profs, sizeof(Profile), count, out) == (size_t)count;
+    ok = (fclose(out) == 0) && ok;
+    ok = ok && rename(tmp.data, index) == 0;
+    if (ok == false) {
+      remove(tmp.data);
+    }
+  }
+  sbuf_free(&tmp);
+  free(slots);
+  free(profs);
+  return ok;
+}
+
+// Check if the index is up to date with the text file.
+static bool current(const Profile_header *h, const struct stat *st)
+{
+  return h->mtime_ns == mtime_ns(st) && h->size == (int64_t)st->st_size &&
+         h->inode == (uint64_t)st->st_ino;
+}
+
+// Check that the slots and names of a mapped index can be used without
+// reading outside of it, since the file may be damaged.
+static bool sane(const Profile_header *h, const uint32_t *slots,
+                 const Profile *profiles)
+{
+  for (uint32_t s = 0; s < h->nslots; s++) {
+    if (slots[s] > h->count) {
+      return false;
+    }
+  }
+  for (uint32_t k = 0; k < h->count; k++) {
+    if (memchr(profiles[k].name, 0, PROFILE_NAMELEN) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Map the index file, compiling it first if needed.
+static bool map_index(Profiles *p, const char *text, const char *index)
+{
+  struct stat st;
+  if (stat(text, &st) != 0) {
+    profiles_close(p);
+    return false;
+  }
+  if (p->header != 0 && current(p->header, &st)) {
+    return true;
+  }
+  profiles_close(p);
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int fd = open(index, O_RDONLY);
+    struct stat ist;
+    if (fd >= 0 && fstat(fd, &ist) == 0 &&
+        ist.st_size >= (off_t)sizeof(Profile_header)) {
+      void *map = mmap(0, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (map != MAP_FAILED) {
+        const Profile_header *h = map;
+        const uint32_t *slots = (const uint32_t*)(h + 1);
+        const Profile *profiles = (const Profile*)(slots + h->nslots);
+        bool valid = h->nslots > h->count && (h->nslots & (h->nslots - 1)) == 0;
+        size_t need = sizeof(Profile_header) + h->nslots * sizeof(uint32_t) +
+                      (size_t)h->count * sizeof(Profile);
+        if (valid && memcmp(h->magic, magic, sizeof(magic)) == 0 &&
+            (size_t)ist.st_size >= need && current(h, &st) &&
+            sane(h, slots, profiles)) {
+          close(fd);
+          p->map = map;
+          p->mapsize = ist.st_size;
+          p->header = h;
+          p->slots = slots;
+          p->profiles = profiles;
+          p->errline = 0;
+          p->error = 0;
+          return h->count > 0;
+        }
+        munmap(map, ist.st_size);
+      }
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (attempt == 0 &&
+        profiles_compile(text, index, &p->errline, &p->error) == false) {
+      break;
+    }
+  }
+  return false;
+}
+
+bool profiles_open(Profiles *p)
+{
+  assert(p);
+  const char *home = getenv("HOME");
+  if (home == 0) {
+    return false;
+  }
+  Sbuf text = {0}, index = {0};
+  sbuf_appends(&text, home);
+  sbuf_appends(&text, textname);
+  sbuf_appends(&index, home);
+  sbuf_appends(&index, indexname);
+  bool found = false;
+  if (text.error == false && index.error == false) {
+    found = map_index(p, text.data, index.data);
+  }
+  sbuf_free(&text);
+  sbuf_free(&index);
+  return found;
+}
+
+void profiles_close(Profiles *p)
+{
+  assert(p);
+  if (p->map != 0) {
+    munmap(p->map, p->mapsize);
+  }
+  int errline = p->errline;
+  const char *error = p->error;
+  memset(p, 0, sizeof(Profiles));
+  p->errline = errline;
+  p->error = error;
+}
+
+uint32_t profiles_count(const Profiles *p)
+{
+  assert(p);
+  return p->header ? p->header->count : 0;
+}
+
+const Profile *profiles_get(const Profiles *p, uint32_t index)
+{
+  assert(p);
+  if (p->header == 0 || index >= p->header->count) {
+    return 0;
+  }
+  return &p->profiles[index];
+}
+
+const Profile *profiles_find(const Profiles *p, const char *name)
+{
+  assert(p);
+  assert(name);
+  if (p->header == 0) {
+    return 0;
+  }
+  uint32_t mask = p->header->nslots - 1;
+  uint32_t s = hash(name) & mask;
+  // A damaged table may have no empty slot; look at each slot once.
+  for (uint32_t n = 0; n < p->header->nslots && p->slots[s] != 0;
+       n++, s = (s + 1) & mask) {
+    const Profile *prof = &p->profiles[p->slots[s]-1];
+    if (strncmp(prof->name, name, PROFILE_NAMELEN) == 0) {
+      return prof;
+    }
+  }
+  return 0;
+}
+
+void profile_color(const Profile *prof, uint16_t product_id, uint8_t rgb[3])
+{
+  assert(prof);
+  memcpy(rgb, prof->color, 3);
+  for (int k = 0; k < prof->ndevices && k < PROFILE_DEVICES; k++) {
+    if (prof->devices[k].product_id == product_id) {
+      memcpy(rgb, prof->devices[k].color, 3);
+    }
+  }
+}
+
+bool profile_apply(const Profile *prof, USB_data *kbd)
+{
+  assert(prof);
+  assert(kbd);
+  if (prof->effect == PROFILE_KEYS && kbd->rows > 0) {
+    uint8_t frame[USB_MAXROWS*USB_MAXCOLS*3];
+    for (int r = 0; r < kbd->rows; r++) {
+      memcpy(frame + 3*kbd->cols*r, prof->keys[r], 3*kbd->cols);
+    }
+    return usb_set_frame(kbd, frame);
+  }
+  uint8_t rgb[3];
+  profile_color(prof, kbd->product_id, rgb);
+  return usb_set_color(kbd, rgb[0], rgb[1], rgb[2]);
+}
@@ -0,0 +1,105 @@
+// file: profile.h
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-19 13:05:44 +0200
+// Last modified: 2026-10-24T15:31:12+0200
+
+// Named lighting profiles.
+//
+// Profiles are written by hand in ~/.x-razer-profiles, like this:
+//
+//   # Comments start with a hash.
+//   [work]
+//   color 0 58 255
+//   effect keys          # “static” (default) or “keys”.
+//   key 0 0 255 0 0      # row column red green blue
+//   device 0x021E 255 255 255  # color for one keyboard model
+//
+// When that file changes, it is compiled into ~/.x-razer-profiles.idx; a hash
+// table with fixed-size records that is memory-mapped. Finding a profile by
+// name or number then does not involve parsing text.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "razer-usb.h"
+
+#define PROFILE_NAMELEN 32
+#define PROFILE_DEVICES 4
+
+typedef enum {
+  PROFILE_STATIC,
+  PROFILE_KEYS,
+} Profile_effect;
+
+typedef struct {
+  uint16_t product_id;
+  uint8_t color[3];
+} Profile_device;
+
+typedef struct {
+  char name[PROFILE_NAMELEN];
+  uint8_t color[3];
+  uint8_t effect;
+  uint8_t ndevices;
+  uint8_t keys[USB_MAXROWS][USB_MAXCOLS][3];
+  Profile_device devices[PROFILE_DEVICES];
+} Profile;
+
+typedef struct {
+  char magic[8];
+  uint32_t count;   // Number of profiles.
+  uint32_t nslots;  // Size of the hash table; a power of two.
+  int64_t mtime_ns; // Modification time of the text file.
+  int64_t size;     // Size of the text file.
+  uint64_t inode;   // Of the text file.
+} Profile_header;
+
+typedef struct {
+  void *map;
+  size_t mapsize;
+  const Profile_header *header;
+  const uint32_t *slots;     // Index+1 of a profile, or 0 if empty.
+  const Profile *profiles;
+  int errline;               // Line with an error in the text file, or 0.
+  const char *error;         // What is wrong with that line.
+} Profiles;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Map the profiles, compiling the text file first if it has changed.
+// Does nothing if the mapped index is still up to date.
+// Returns false if there are no profiles.
+extern bool profiles_open(Profiles *p);
+extern void profiles_close(Profiles *p);
+
+// Compile the text file “text” into the index file “index”.
+// On an error in the text, *errline is set to the line number and *error
+// to a description, e.g. “duplicate profile name”.
+extern bool profiles_compile(const char *text, const char *index, int *errline,
+                             const char **error);
+
+// Return the number of profiles.
+extern uint32_t profiles_count(const Profiles *p);
+// Return a profile by number or by name, or 0 if it does not exist.
+extern const Profile *profiles_get(const Profiles *p, uint32_t index);
+extern const Profile *profiles_find(const Profiles *p, const char *name);
+
+// The color of a profile for a keyboard model.
+extern void profile_color(const Profile *prof, uint16_t product_id,
+                          uint8_t rgb[3]);
+
+// Set a profile on a keyboard.
+extern bool profile_apply(const Profile *prof, USB_data *kbd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,39 +5,49 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-28 16:01:44 +0200
-// Last modified: 2025-08-31T13:29:43+0200
+// Last modified: 2026-10-24T10:58:02+0200
 
+#define _POSIX_C_SOURCE 200809L
 #include "razer-usb.h"
+#include "metrics.h"
 
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include <libusb.h>
 
+// Timeout for a single report in ms.
+#define USB_TIMEOUT 1000
+// Number of times a failed report is sent again.
+#define USB_RETRIES 1
+// Failed attempts to handle USB events before a transfer is given up.
+#define USB_EVENT_ERRORS 3
+// Number of reports sent to measure the throughput of a keyboard.
+#define CALIB_REPORTS 4
+// Bounds for the time between frames; the upper bound limits the latency.
+#define MIN_FRAME_NS 33000000
+#define MAX_FRAME_NS 100000000
+
+static_assert(sizeof(USB_buffer) == 98, "USB_buffer must not be padded");
+
 typedef struct {
-  uint8_t status;
-  uint8_t transaction_id;
-  uint16_t remaining_packets; /* Big Endian */
-  uint8_t protocol_type; /*0x0*/
-  uint8_t data_size;
-  uint8_t command_class;
-  uint8_t command_id;
-  uint8_t arguments[80];
-  uint8_t crc;/*xor'ed bytes of report*/
-  uint8_t reserved; /*0x0*/
-} Razer_report;
-
-static const char *errors[5] = {
+  uint16_t id;
+  uint8_t rows, cols;
+} Keyboard;
+
+static const char *errors[6] = {
   "Could not initialize USB.",
   "Not a supported keyboard.",
   "Could not retrieve product name.",
   "Could not get a list of USB devices.",
   "Could not get a USB device descriptor.",
+  "Could not open the keyboard.",
 };
 
-uint8_t calculate_crc(Razer_report *report)
+static uint8_t calculate_crc(Razer_report *report)
 {
   uint8_t *_report = (uint8_t*)report;
   uint8_t crc = 0;
@@ -47,15 +57,139 @@ uint8_t calculate_crc(Razer_report *report)
   return crc;
 }
 
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Re-evaluate the frame interval and level of detail from the average time
+// per report. Per-key frames take a report per row plus one to show them.
+static void governor_update(USB_data *kbd)
+{
+  USB_governor *g = &kbd->gov;
+  int64_t perkey_ns = (kbd->rows + 1) * g->avg_ns * 5 / 4;
+  if (kbd->rows == 0) {
+    g->perkey = false;
+  } else if (g->perkey && perkey_ns > MAX_FRAME_NS) {
+    g->perkey = false;
+  } else if (g->perkey == false && perkey_ns < MAX_FRAME_NS * 3 / 4) {
+    g->perkey = true;
+  }
+  int64_t cost = g->perkey ? perkey_ns : g->avg_ns * 5 / 4;
+  g->frame_ns = cost < MIN_FRAME_NS ? MIN_FRAME_NS : cost;
+}
+
+static void LIBUSB_CALL transfer_done(struct libusb_transfer *transfer)
+{
+  *(int*)transfer->user_data = 1;
+}
+
+// Synchronous control transfer using the pre-allocated transfer.
+// Unlike libusb_control_transfer, this makes no allocation of our own per
+// transfer; libusb itself may still allocate, like URBs on Linux.
+// Returns the number of bytes transferred, or a libusb error code.
+static int usb_transfer(USB_data *kbd, USB_buffer *buf, uint8_t type,
+                        uint8_t request)
+{
+  if (kbd->handle == 0 || kbd->transfer == 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  int completed = 0;
+  libusb_fill_control_setup(buf->setup, type, request, 0x300, 0x01, 90);
+  libusb_fill_control_transfer(kbd->transfer, kbd->handle, (uint8_t*)buf,
+                               transfer_done, &completed, USB_TIMEOUT);
+  int rv = libusb_submit_transfer(kbd->transfer);
+  if (rv != 0) {
+    return rv;
+  }
+  for (int failures = 0; completed == 0; ) {
+    int err = libusb_handle_events_completed(0, &completed);
+    if (err < 0 && err != LIBUSB_ERROR_INTERRUPTED) {
+      if (++failures > USB_EVENT_ERRORS) {
+        // Abandon the transfer, since libusb may still own it. Its callback
+        // only runs while events are handled, so point it away from
+        // “completed” first. Without a transfer, the retry in usb_send
+        // fails with NO_DEVICE and closes the keyboard.
+        static int abandoned;
+        kbd->transfer->user_data = &abandoned;
+        kbd->transfer = 0;
+        return err;
+      }
+      libusb_cancel_transfer(kbd->transfer);
+    }
+  }
+  if (kbd->transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  } else if (kbd->transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+    return LIBUSB_ERROR_IO;
+  }
+  return kbd->transfer->actual_length;
+}
+
+// Send a report, and feed the time it took to the governor.
+static bool usb_send(USB_data *kbd, USB_buffer *buf)
+{
+  buf->report.crc = calculate_crc(&buf->report);
+  for (int attempt = 0; ; attempt++) {
+    int64_t start = now_ns();
+    int bytes = usb_transfer(kbd, buf, 0x21, 0x09);
+    int64_t elapsed = now_ns() - start;
+    kbd->gov.avg_ns += (elapsed - kbd->gov.avg_ns) / 8;
+    if (bytes == 90) {
+      METRIC_ADD(usb_sent, 1);
+      return true;
+    }
+    if (bytes == LIBUSB_ERROR_NO_DEVICE) {
+      // Unplugged; a new usb_init can find it again.
+      usb_close(kbd);
+    }
+    if (attempt == USB_RETRIES || kbd->handle == 0) {
+      METRIC_ADD(usb_failed, 1);
+      return false;
+    }
+    METRIC_ADD(usb_retried, 1);
+  }
+}
+
+// Measure the time per report by sending harmless firmware version queries.
+// usb_init keeps the result when the same product is opened again with
+// “kbd”, so reconnecting is fast.
+void usb_calibrate(USB_data *kbd)
+{
+  assert(kbd);
+  USB_governor *g = &kbd->gov;
+  g->calibrated = true;
+  USB_buffer query = {
+    .report = {
+      .transaction_id = 0x3f,
+      .data_size = 0x02,
+      .command_class = 0x00,
+      .command_id = 0x81,
+    }
+  };
+  query.report.crc = calculate_crc(&query.report);
+  int64_t start = now_ns();
+  for (int k = 0; k < CALIB_REPORTS; k++) {
+    usb_transfer(kbd, &query, 0x21, 0x09);
+  }
+  g->report_ns = g->avg_ns = (now_ns() - start) / CALIB_REPORTS;
+  governor_update(kbd);
+}
+
 void usb_init(USB_data *out)
 {
-  const uint16_t keyboard_ids[] = {
-    0x0228, // Blackwidow Elite
-    0x021E, // Ornata Chroma
+  const Keyboard keyboards[] = {
+    {0x0228, 6, 22}, // Blackwidow Elite
+    {0x021E, 6, 22}, // Ornata Chroma
   };
   if (out == 0) {
     return;
   }
+  // A calibration belongs to this struct and its product.
+  uint16_t previous = out->product_id;
+  USB_governor gov = out->gov;
   memset(out, 0, sizeof(USB_data));
   if (libusb_init(0) != 0) {
     out->errormsg = errors[0];
@@ -68,6 +202,7 @@ void usb_init(USB_data *out)
     return;
   }
   libusb_device_descriptor desc = {0};
+  const Keyboard *found = 0;
   for (int32_t k = 0; k < device_count; k++) {
     if (libusb_get_device_descriptor(device_list[k], &desc) != 0) {
       out->errormsg = errors[4];
@@ -76,19 +211,22 @@ void usb_init(USB_data *out)
     if (desc.idVendor != 0x1532) { // Not a Razer device.
       continue; // Try next device.
     }
-    bool found = false;
-    for (int32_t j = 0; j < sizeof(keyboard_ids)/sizeof(keyboard_ids[0]); j++) {
-      if (desc.idProduct == keyboard_ids[j]) {
-        found = true;
+    found = 0;
+    for (size_t j = 0; j < sizeof(keyboards)/sizeof(keyboards[0]); j++) {
+      if (desc.idProduct == keyboards[j].id) {
+        found = &keyboards[j];
         break;
       }
     }
-    if (found == false) { // Not a device in the list.
+    if (found == 0) { // Not a device in the list.
       out->errormsg = errors[1];
       continue; // Try next device.
     }
+    // Forget an unsupported device that came before this one.
+    out->errormsg = 0;
     if (libusb_open(device_list[k], &out->handle) != 0) {
       out->handle = 0;
+      out->errormsg = errors[5];
       break;
     }
     if (libusb_get_string_descriptor_ascii(out->handle, desc.iProduct,
@@ -99,6 +237,34 @@ void usb_init(USB_data *out)
     }
   }
   libusb_free_device_list(device_list, 1);
+  if (out->handle != 0 && found != 0) {
+    out->product_id = found->id;
+    out->rows = found->rows;
+    out->cols = found->cols;
+    out->transfer = libusb_alloc_transfer(0);
+    METRIC_ADD(connects, 1);
+    if (gov.calibrated && previous == out->product_id) {
+      out->gov.report_ns = out->gov.avg_ns = gov.report_ns;
+      out->gov.calibrated = true;
+      governor_update(out);
+    }
+  } else if (out->errormsg == 0) { // No Razer device at all.
+    out->errormsg = errors[1];
+  }
+}
+
+void usb_close(USB_data *kbd)
+{
+  assert(kbd);
+  if (kbd->transfer != 0) {
+    libusb_free_transfer(kbd->transfer);
+    kbd->transfer = 0;
+  }
+  if (kbd->handle != 0) {
+    libusb_close(kbd->handle);
+    kbd->handle = 0;
+    METRIC_ADD(disconnects, 1);
+  }
 }
 
 void usb_exit(void)
@@ -106,11 +272,11 @@ void usb_exit(void)
   libusb_exit(0);
 }
 
-bool usb_set_color(USB_data *kbd, uint8_t red, uint8_t green, uint8_t blue)
+void usb_report_color(Razer_report *out, uint8_t red, uint8_t green,
+                      uint8_t blue)
 {
-  assert(kbd);
-  // control message
-  Razer_report out = {
+  assert(out);
+  *out = (Razer_report) {
     .status = 0x00,
     .transaction_id = 0x3f,
     .remaining_packets = 0x0000,
@@ -120,15 +286,162 @@ bool usb_set_color(USB_data *kbd, uint8_t red, uint8_t green, uint8_t blue)
     .command_id = 0x02,
     .arguments = "\x01\x05\x01\x00\x00\x01",
   };
-  out.arguments[6] = red;
-  out.arguments[7] = green;
-  out.arguments[8] = blue;
-  out.crc = calculate_crc(&out);
-  int bytes = 0;
-  bytes = libusb_control_transfer(kbd->handle, 0x21, 0x09, 0x300, 0x01,
-                                  (uint8_t*)&out, 90, 0);
-  if (bytes == 90) {
-    return true;
-  }
-  return false;
+  out->arguments[6] = red;
+  out->arguments[7] = green;
+  out->arguments[8] = blue;
+}
+
+void usb_report_row(Razer_report *out, uint8_t row, uint8_t cols,
+                    const uint8_t *rgb)
+{
+  assert(out);
+  assert(rgb);
+  assert(cols > 0 && cols <= USB_MAXCOLS);
+  *out = (Razer_report) {
+    .transaction_id = 0x3f,
+    .command_class = 0x0f,
+    .command_id = 0x03,
+  };
+  out->data_size = 5 + 3 * cols;
+  out->arguments[2] = row;
+  out->arguments[4] = cols - 1; // stop column
+  memcpy(out->arguments + 5, rgb, 3 * cols);
+}
+
+bool usb_send_report(USB_data *kbd, USB_buffer *buf)
+{
+  assert(kbd);
+  assert(buf);
+  return usb_send(kbd, buf);
+}
+
+bool usb_query_report(USB_data *kbd, USB_buffer *buf)
+{
+  assert(kbd);
+  assert(buf);
+  if (usb_send(kbd, buf) == false) {
+    return false;
+  }
+  return usb_transfer(kbd, buf, 0xa1, 0x01) == 90;
+}
+
+bool usb_get_firmware(USB_data *kbd, USB_buffer *buf, uint8_t version[2])
+{
+  assert(version);
+  buf->report = (Razer_report) {
+    .transaction_id = 0xff,
+    .data_size = 0x02,
+    .command_class = 0x00,
+    .command_id = 0x81,
+  };
+  if (usb_query_report(kbd, buf) == false) {
+    return false;
+  }
+  version[0] = buf->report.arguments[0];
+  version[1] = buf->report.arguments[1];
+  return true;
+}
+
+bool usb_get_serial(USB_data *kbd, USB_buffer *buf, char *serial, size_t len)
+{
+  assert(serial);
+  assert(len > 0);
+  buf->report = (Razer_report) {
+    .transaction_id = 0xff,
+    .data_size = 0x16,
+    .command_class = 0x00,
+    .command_id = 0x82,
+  };
+  if (usb_query_report(kbd, buf) == false) {
+    return false;
+  }
+  size_t datasize = buf->report.data_size;
+  if (datasize >= len) {
+    datasize = len - 1;
+  }
+  if (datasize > sizeof(buf->report.arguments)) {
+    datasize = sizeof(buf->report.arguments);
+  }
+  memcpy(serial, buf->report.arguments, datasize);
+  serial[datasize] = 0;
+  return true;
+}
+
+bool usb_set_color(USB_data *kbd, uint8_t red, uint8_t green, uint8_t blue)
+{
+  assert(kbd);
+  // control message
+  USB_buffer out;
+  usb_report_color(&out.report, red, green, blue);
+  bool rv = usb_send(kbd, &out);
+  kbd->gov.next_ns = now_ns() + kbd->gov.frame_ns;
+  return rv;
+}
+
+// Calibrate before the governor is first needed.
+static void calibrate_once(USB_data *kbd)
+{
+  if (kbd->gov.calibrated == false && kbd->handle != 0) {
+    usb_calibrate(kbd);
+  }
+}
+
+bool usb_frame_due(USB_data *kbd)
+{
+  assert(kbd);
+  calibrate_once(kbd);
+  return now_ns() >= kbd->gov.next_ns;
+}
+
+int usb_frame_wait(USB_data *kbd)
+{
+  assert(kbd);
+  int64_t wait = kbd->gov.next_ns - now_ns();
+  if (wait <= 0) {
+    return 0;
+  }
+  return (int)((wait + 999999) / 1000000);
+}
+
+bool usb_set_frame(USB_data *kbd, const uint8_t *rgb)
+{
+  assert(kbd);
+  assert(rgb);
+  bool rv = true;
+  // Without it, per-key frames would fall back to the average color.
+  calibrate_once(kbd);
+  if (kbd->gov.perkey == false) {
+    // Level of detail: the average color of the frame.
+    int32_t n = kbd->rows * kbd->cols;
+    uint32_t sum[3] = {0};
+    for (int32_t k = 0; k < n; k++) {
+      sum[0] += rgb[3*k];
+      sum[1] += rgb[3*k+1];
+      sum[2] += rgb[3*k+2];
+    }
+    if (n > 0) {
+      rv = usb_set_color(kbd, sum[0]/n, sum[1]/n, sum[2]/n);
+    }
+  } else {
+    // Load each row into the keyboard...
+    USB_buffer buf;
+    for (uint8_t r = 0; r < kbd->rows && rv; r++) {
+      usb_report_row(&buf.report, r, kbd->cols, rgb + 3 * kbd->cols * r);
+      rv = usb_send(kbd, &buf);
+    }
+    // ...and then show the custom frame.
+    buf.report = (Razer_report) {
+      .transaction_id = 0x3f,
+      .data_size = 0x0c,
+      .command_class = 0x0f,
+      .command_id = 0x02,
+      .arguments = "\x00\x05\x08",
+    };
+    if (rv) {
+      rv = usb_send(kbd, &buf);
+    }
+  }
+  governor_update(kbd);
+  kbd->gov.next_ns = now_ns() + kbd->gov.frame_ns;
+  return rv;
 }
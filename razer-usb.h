@@ -5,23 +5,108 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-28 16:30:17 +0200
-// Last modified: 2025-08-28T19:52:37+0200
+// Last modified: 2026-10-24T09:12:31+0200
 
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <libusb.h>
 
+typedef struct {
+  uint8_t status;
+  uint8_t transaction_id;
+  uint16_t remaining_packets; /* Big Endian */
+  uint8_t protocol_type; /*0x0*/
+  uint8_t data_size;
+  uint8_t command_class;
+  uint8_t command_id;
+  uint8_t arguments[80];
+  uint8_t crc;/*xor'ed bytes of report*/
+  uint8_t reserved; /*0x0*/
+} Razer_report;
+
+// A report, with room for the USB setup packet in front of it.
+// Sending a report from a caller supplied buffer makes no allocation of our
+// own per transfer.
+typedef struct {
+  uint8_t setup[8];
+  Razer_report report;
+} USB_buffer;
+
+// Largest LED matrix of the supported keyboards.
+#define USB_MAXROWS 6
+#define USB_MAXCOLS 22
+
+// The governor keeps the number of reports sent to a keyboard within what
+// it can sustain. Times are in nanoseconds.
+typedef struct {
+  int64_t report_ns;  // Time per report, measured when connecting.
+  int64_t avg_ns;     // Moving average of the time per report.
+  int64_t frame_ns;   // Current time between frames.
+  int64_t next_ns;    // Earliest time the next frame may be sent.
+  bool perkey;        // Per-key frames can keep up; else use a global color.
+  bool calibrated;    // report_ns was measured; see usb_calibrate.
+} USB_governor;
+
 typedef struct {
   const char *errormsg;
   char product_name[80];
   libusb_device_handle *handle;
+  struct libusb_transfer *transfer;  // Re-used for every report.
+  uint16_t product_id;
+  uint8_t rows, cols;  // Size of the LED matrix.
+  USB_governor gov;
 } USB_data;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // If the initialization is succecfull, out->errormsg is 0.
 // Otherwise it points to an error message.
+// This and usb_close are the only functions that allocate memory
+// themselves; libusb may still allocate per transfer, like URBs on Linux.
+// “out” must be zeroed, or have been used by usb_init before; then the
+// calibration is kept if it is the same keyboard.
 extern void usb_init(USB_data *out);
+extern void usb_close(USB_data *kbd);
 extern void usb_exit(void);
 
+// Fill in a report for a static color, or for a row of a per-key frame.
+extern void usb_report_color(Razer_report *out, uint8_t red, uint8_t green,
+                             uint8_t blue);
+extern void usb_report_row(Razer_report *out, uint8_t row, uint8_t cols,
+                           const uint8_t *rgb);
+
+// Send the report in “buf”. The CRC is filled in.
+extern bool usb_send_report(USB_data *kbd, USB_buffer *buf);
+// Send the report in “buf”, and read the reply into it.
+extern bool usb_query_report(USB_data *kbd, USB_buffer *buf);
+
+// Read the firmware version as major, minor.
+extern bool usb_get_firmware(USB_data *kbd, USB_buffer *buf, uint8_t version[2]);
+// Read the serial number as a null-terminated string.
+extern bool usb_get_serial(USB_data *kbd, USB_buffer *buf, char *serial, size_t len);
+
 extern bool usb_set_color(USB_data *kbd, uint8_t red, uint8_t green, uint8_t blue);
+
+// Measure the time per report with a few queries, for the governor.
+// usb_frame_due and usb_set_frame do this the first time they are called,
+// so programs that only set a color once don't pay for it.
+extern void usb_calibrate(USB_data *kbd);
+
+// Returns true when the governor allows the next frame to be sent.
+extern bool usb_frame_due(USB_data *kbd);
+// Returns the time in ms until the next frame may be sent.
+extern int usb_frame_wait(USB_data *kbd);
+
+// Send a frame of kbd->rows × kbd->cols RGB triplets, row by row.
+// If the keyboard cannot keep up with per-key frames, the average color of
+// the frame is sent instead.
+extern bool usb_set_frame(USB_data *kbd, const uint8_t *rgb);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,21 +5,35 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-28 18:48:01 +0200
-// Last modified: 2026-02-22T11:47:28+0100
+// Last modified: 2026-10-24T13:52:16+0200
 
+#define _POSIX_C_SOURCE 200809L
 #include "rc.h"
+#include "metrics.h"
 #include "sbuf.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__has_include)
+#if __has_include(<sys/inotify.h>)
+#include <sys/inotify.h>
+#define HAVE_INOTIFY 1
+#endif
+#endif
 
 // Macro to skip whitespace in a string.
 #define SKIPWS(ptr) \
   while (*(ptr) == ' ' || *(ptr) == '\t' || *(ptr) == '\r' || *(ptr) == '\n') {(ptr)++;}
 
-#define CLAMP(val) ((val)<0)?0:((val)>255?255:(val))
+#define CLAMP(val) (((val)<0)?0:((val)>255?255:(val)))
 
 
 static const char *filename = "/.x-razerrc";
@@ -31,6 +45,7 @@ void read_rc(RC_data *result)
 {
   assert(result);
   Sbuf sbuf = {0};
+  METRIC_ADD(rc_reads, 1);
   result->ok = false;
   result->red = result->green = result->blue = 0;
   const char *home = getenv("HOME");
@@ -40,34 +55,39 @@ void read_rc(RC_data *result)
   sbuf_appends(&sbuf, home);
   sbuf_appends(&sbuf, filename);
   if (sbuf.error == true) {
+    sbuf_free(&sbuf);
     return;
   }
   FILE *rcfile = fopen(sbuf.data, "r");
   if (rcfile == 0) {
+    sbuf_free(&sbuf);
     return;
   }
+  // Read the whole file, whatever its size.
   sbuf_reset(&sbuf);
-  sbuf.used = fread(sbuf.data, 1, SBUF_SIZE, rcfile);
+  bool ok = sbuf_fread(&sbuf, rcfile);
   fclose(rcfile);
-  if (sbuf.used == 0) {
+  if (ok == false || sbuf.used == 0) {
+    sbuf_free(&sbuf);
     return;
   }
+  long rgb[3];
   char *cur = sbuf.data;
-  SKIPWS(cur);
-  long red = strtol(cur, &cur, 10);
-  CLAMP(red);
-  SKIPWS(cur);
-  long green = strtol(cur, &cur, 10);
-  CLAMP(green);
-  SKIPWS(cur);
-  long blue = strtol(cur, &cur, 10);
-  CLAMP(blue);
-  if (errno == EINVAL) {
+  for (int k = 0; k < 3 && ok; k++) {
+    char *end;
+    SKIPWS(cur);
+    rgb[k] = strtol(cur, &end, 10);
+    ok = end != cur;
+    rgb[k] = CLAMP(rgb[k]);
+    cur = end;
+  }
+  sbuf_free(&sbuf);
+  if (ok == false) {
     return;
   }
-  result->red = red;
-  result->green = green;
-  result->blue = blue;
+  result->red = rgb[0];
+  result->green = rgb[1];
+  result->blue = rgb[2];
   result->ok = true;
   return;
 }
@@ -75,7 +95,8 @@ void read_rc(RC_data *result)
 void write_rc(RC_data *result)
 {
   assert(result);
-  Sbuf sbuf = {0};
+  Sbuf sbuf = {0}, tmp = {0};
+  METRIC_ADD(rc_writes, 1);
   result->ok = false;
   const char *home = getenv("HOME");
   if (home == 0) {
@@ -83,14 +104,238 @@ void write_rc(RC_data *result)
   }
   sbuf_appends(&sbuf, home);
   sbuf_appends(&sbuf, filename);
-    if (sbuf.error == true) {
-    return;
+  sbuf_printf(&tmp, "%s.XXXXXX", sbuf.data);
+  // Write a temporary file, and rename it to the RC file once it is safely
+  // on disk. So a crash leaves either the old or the new file. The name is
+  // unique, so that writers in other processes don't write the same file.
+  FILE *rcfile = 0;
+  if (sbuf.error == false && tmp.error == false) {
+    int fd = mkstemp(tmp.data);
+    rcfile = fd < 0 ? 0 : fdopen(fd, "w");
+    if (fd >= 0 && rcfile == 0) {
+      close(fd);
+      remove(tmp.data);
+    }
   }
-  FILE *rcfile = fopen(sbuf.data, "w");
-  if (rcfile == 0) {
+  if (rcfile != 0) {
+    fprintf(rcfile, "%d\n%d\n%d\n", result->red, result->green, result->blue);
+    bool ok = fflush(rcfile) == 0 && fsync(fileno(rcfile)) == 0;
+    ok = (fclose(rcfile) == 0) && ok;
+    if (ok == false || rename(tmp.data, sbuf.data) != 0) {
+      remove(tmp.data);
+    } else {
+      result->ok = true;
+    }
+  }
+  sbuf_free(&sbuf);
+  sbuf_free(&tmp);
+}
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  bool running;
+  bool stop;
+  bool pending;
+  RC_data data;
+  struct timespec deadline;  // Write when no request came before this.
+  RC_notify notify;
+  void *arg;
+  atomic_int status;
+} writer = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool before(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void *writer_thread(void *unused)
+{
+  (void)unused;
+  pthread_mutex_lock(&writer.lock);
+  while (true) {
+    while (writer.pending == false && writer.stop == false) {
+      pthread_cond_wait(&writer.cond, &writer.lock);
+    }
+    if (writer.pending == false) { // Stopped.
+      break;
+    }
+    // Wait until the requests have stopped coming.
+    while (writer.stop == false) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (before(&now, &writer.deadline) == false) {
+        break;
+      }
+      pthread_cond_timedwait(&writer.cond, &writer.lock, &writer.deadline);
+    }
+    RC_data data = writer.data;
+    RC_notify notify = writer.notify;
+    void *arg = writer.arg;
+    writer.pending = false;
+    pthread_mutex_unlock(&writer.lock);
+    write_rc(&data);
+    RC_status status = data.ok ? RC_WRITTEN : RC_FAILED;
+    pthread_mutex_lock(&writer.lock);
+    // Don't report the outcome if a new request is already waiting.
+    if (writer.pending == false) {
+      atomic_store(&writer.status, status);
+    }
+    pthread_mutex_unlock(&writer.lock);
+    if (notify != 0) {
+      notify(status, arg);
+    }
+    pthread_mutex_lock(&writer.lock);
+  }
+  pthread_mutex_unlock(&writer.lock);
+  return 0;
+}
+
+void write_rc_async(const RC_data *data, RC_notify notify, void *arg)
+{
+  assert(data);
+  pthread_mutex_lock(&writer.lock);
+  if (writer.running == false) {
+    writer.stop = false;
+    // Measure the debounce on the monotonic clock, so that setting the
+    // time does not stretch or skip it. Nothing waits on it now.
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&writer.cond);
+    pthread_cond_init(&writer.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&writer.thread, 0, writer_thread, 0) != 0) {
+      pthread_mutex_unlock(&writer.lock);
+      // Fall back to writing synchronously.
+      RC_data copy = *data;
+      write_rc(&copy);
+      atomic_store(&writer.status, copy.ok ? RC_WRITTEN : RC_FAILED);
+      if (notify != 0) {
+        notify(copy.ok ? RC_WRITTEN : RC_FAILED, arg);
+      }
+      return;
+    }
+    writer.running = true;
+  }
+  writer.data = *data;
+  writer.notify = notify;
+  writer.arg = arg;
+  writer.pending = true;
+  clock_gettime(CLOCK_MONOTONIC, &writer.deadline);
+  writer.deadline.tv_nsec += RC_DEBOUNCE * 1000000L;
+  writer.deadline.tv_sec += writer.deadline.tv_nsec / 1000000000L;
+  writer.deadline.tv_nsec %= 1000000000L;
+  atomic_store(&writer.status, RC_PENDING);
+  pthread_cond_signal(&writer.cond);
+  pthread_mutex_unlock(&writer.lock);
+}
+
+RC_status write_rc_status(void)
+{
+  return atomic_load(&writer.status);
+}
+
+void write_rc_flush(void)
+{
+  pthread_mutex_lock(&writer.lock);
+  if (writer.running == false) {
+    pthread_mutex_unlock(&writer.lock);
     return;
   }
-  fprintf(rcfile, "%d\n%d\n%d\n", result->red, result->green, result->blue);
-  fclose(rcfile);
-  result->ok = true;
+  writer.stop = true;
+  pthread_cond_signal(&writer.cond);
+  pthread_mutex_unlock(&writer.lock);
+  pthread_join(writer.thread, 0);
+  writer.running = false;
+}
+
+// Remember the state of the RC file. Returns true if it changed.
+static bool rc_stat(RC_watch *w)
+{
+  Sbuf sbuf = {0};
+  const char *home = getenv("HOME");
+  if (home == 0) {
+    return false;
+  }
+  sbuf_appends(&sbuf, home);
+  sbuf_appends(&sbuf, filename);
+  struct stat st;
+  bool found = sbuf.error == false && stat(sbuf.data, &st) == 0;
+  sbuf_free(&sbuf);
+  if (found == false) {
+    return false;
+  }
+  int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  bool changed = mtime_ns != w->mtime_ns || st.st_size != w->size ||
+                 st.st_ino != w->inode;
+  w->mtime_ns = mtime_ns;
+  w->size = st.st_size;
+  w->inode = st.st_ino;
+  return changed;
+}
+
+bool rc_watch_open(RC_watch *w)
+{
+  assert(w);
+  memset(w, 0, sizeof(RC_watch));
+  w->fd = -1;
+#ifdef HAVE_INOTIFY
+  const char *home = getenv("HOME");
+  if (home == 0) {
+    return false;
+  }
+  // Watch the directory, since an atomic write replaces the file.
+  w->fd = inotify_init();
+  if (w->fd < 0) {
+    return false;
+  }
+  if (inotify_add_watch(w->fd, home, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(w->fd);
+    w->fd = -1;
+    return false;
+  }
+  rc_stat(w);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool rc_watch_changed(RC_watch *w)
+{
+  assert(w);
+#ifdef HAVE_INOTIFY
+  _Alignas(struct inotify_event) char buf[4096];
+  ssize_t len = read(w->fd, buf, sizeof(buf));
+  if (len < 0) {
+    // Closing is up to the owner; this can run in another thread.
+    w->error = errno != EINTR;
+    return false;
+  }
+  // Other files in $HOME are written too; only stat for our own.
+  bool ours = false;
+  for (char *p = buf; ours == false && p < buf + len; ) {
+    struct inotify_event *ev = (struct inotify_event*)p;
+    ours = ev->len > 0 && strcmp(ev->name, filename + 1) == 0;
+    p += sizeof(struct inotify_event) + ev->len;
+  }
+  return ours && rc_stat(w);
+#else
+  return false;
+#endif
+}
+
+void rc_watch_close(RC_watch *w)
+{
+  assert(w);
+  if (w->fd >= 0) {
+    close(w->fd);
+    w->fd = -1;
+  }
 }
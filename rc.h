@@ -5,7 +5,7 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-28 18:48:01 +0200
-// Last modified: 2025-08-28T19:58:23+0200
+// Last modified: 2026-10-24T13:10:42+0200
 
 #pragma once
 #include <stdbool.h>
@@ -16,6 +16,53 @@ typedef struct {
   uint8_t red, green, blue;
 } RC_data;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  RC_IDLE,     // Nothing has been written yet.
+  RC_PENDING,  // A write is waiting or in progress.
+  RC_WRITTEN,  // The last write succeeded.
+  RC_FAILED,   // The last write failed.
+} RC_status;
+
+// Called from the writer thread when a write has finished.
+typedef void (*RC_notify)(RC_status status, void *arg);
+
 // Read or write ~/.x-razerrc.
+// Writing replaces the file atomically.
 extern void read_rc(RC_data *result);
 extern void write_rc(RC_data *result);
+
+// Write ~/.x-razerrc from a background thread. Requests that follow each
+// other within RC_DEBOUNCE ms are coalesced into a single write of the last
+// data. “notify” may be 0.
+#define RC_DEBOUNCE 500
+extern void write_rc_async(const RC_data *data, RC_notify notify, void *arg);
+// Outcome of the asynchronous writes.
+extern RC_status write_rc_status(void);
+// Write a pending request now, and stop the writer thread.
+extern void write_rc_flush(void);
+
+// Watch ~/.x-razerrc for changes, using inotify where available.
+typedef struct {
+  int fd;      // Readable when something happened; -1 if not watching.
+  bool error;  // Reading fd failed; stop watching and close it.
+  int64_t mtime_ns;
+  int64_t size;
+  uint64_t inode;
+} RC_watch;
+
+// Start watching. Returns false if that is not possible.
+extern bool rc_watch_open(RC_watch *w);
+// Wait for events on w->fd. Returns true if the RC file was replaced or
+// written and its modification time, size or inode differ from last time.
+// On a read error w->error is set. The watch is not closed then, since
+// that is up to the thread that opened it, with rc_watch_close.
+extern bool rc_watch_changed(RC_watch *w);
+extern void rc_watch_close(RC_watch *w);
+
+#ifdef __cplusplus
+}
+#endif
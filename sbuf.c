@@ -5,41 +5,64 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-28 23:49:02 +0200
-// Last modified: 2026-02-22T11:28:54+0100
+// Last modified: 2026-10-24T14:05:27+0200
 
+#define _POSIX_C_SOURCE 200809L
 #include "sbuf.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 
-void sbuf_append(Sbuf *buf, const char *str, const ptrdiff_t len)
+// Make room for “len” more bytes plus the terminating null.
+// Returns false, and sets the error flag, if that is not possible.
+static bool reserve(Sbuf *buf, ptrdiff_t len)
 {
-  assert(buf!=0);
-  assert(str!=0);
   if (buf->error == true) {
-    return;
+    return false;
   }
-  ptrdiff_t alen = strnlen(str, len);
-  ptrdiff_t remaining = SBUF_SIZE - buf->used - 1;
-  if (len < remaining) {
-    memcpy(buf->data+buf->used, str, alen);
-    buf->used += alen;
-    buf->error = false;
-  } else {
+  ptrdiff_t need = buf->used + len + 1;
+  if (need <= buf->cap) {
+    return true;
+  }
+  if (len < 0 || need > SBUF_MAX) {
+    buf->error = true;
+    return false;
+  }
+  ptrdiff_t cap = buf->cap ? buf->cap : SBUF_MIN;
+  while (cap < need) {
+    cap *= 2;
+  }
+  char *data = realloc(buf->data, cap);
+  if (data == 0) {
     buf->error = true;
+    return false;
   }
+  buf->data = data;
+  buf->cap = cap;
+  return true;
 }
 
-inline void sbuf_appends(Sbuf *buf, const char *str)
+void sbuf_append(Sbuf *buf, const char *str, const ptrdiff_t len)
 {
   assert(buf!=0);
-  if (buf->error == true) {
+  assert(str!=0);
+  ptrdiff_t alen = strnlen(str, len);
+  if (reserve(buf, alen) == false) {
     return;
   }
-  ptrdiff_t remaining = SBUF_SIZE - buf->used - 1;
-  sbuf_append(buf, str, strnlen(str, remaining));
+  memcpy(buf->data+buf->used, str, alen);
+  buf->used += alen;
+  buf->data[buf->used] = 0;
+}
+
+void sbuf_appends(Sbuf *buf, const char *str)
+{
+  assert(buf!=0);
+  assert(str!=0);
+  sbuf_append(buf, str, strlen(str));
 }
 
 void sbuf_printf(Sbuf *buf, const char *fmt, ...)
@@ -49,39 +72,93 @@ void sbuf_printf(Sbuf *buf, const char *fmt, ...)
   if (buf->error == true) {
     return;
   }
-  ptrdiff_t remaining = SBUF_SIZE - buf->used - 1;
+  // Try with the space that is left first; most of the time it fits.
+  ptrdiff_t remaining = buf->cap ? buf->cap - buf->used : 0;
   va_list ap;
   va_start(ap, fmt);
-  ptrdiff_t used = vsnprintf(buf->data+buf->used, remaining, fmt, ap);
+  ptrdiff_t used = vsnprintf(buf->data ? buf->data+buf->used : 0,
+                             remaining, fmt, ap);
   va_end(ap);
-  if (used > remaining) { // discard
-    memset(buf->data+buf->used, 0, remaining);
+  if (used < 0) {
     buf->error = true;
-  } else {
-    buf->error = false;
-    buf->used += used;
+    return;
+  }
+  if (used >= remaining) {
+    if (reserve(buf, used) == false) {
+      if (buf->data != 0) {
+        buf->data[buf->used] = 0; // discard
+      }
+      return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(buf->data+buf->used, used + 1, fmt, ap);
+    va_end(ap);
+  }
+  buf->used += used;
+}
+
+bool sbuf_fread(Sbuf *buf, FILE *stream)
+{
+  assert(buf!=0);
+  assert(stream!=0);
+  for (;;) {
+    // Read straight into the buffer; reserve doubles it as it fills up.
+    ptrdiff_t want = SBUF_MAX - 1 - buf->used;
+    if (want > SBUF_MIN) {
+      want = SBUF_MIN;
+    }
+    if (want <= 0) {
+      // Full; that is only fine if nothing is left.
+      if (buf->error == false && getc(stream) == EOF) {
+        return ferror(stream) == 0;
+      }
+      buf->error = true;
+      return false;
+    }
+    if (reserve(buf, want) == false) {
+      return false;
+    }
+    ptrdiff_t room = buf->cap - buf->used - 1;
+    size_t n = fread(buf->data+buf->used, 1, room, stream);
+    buf->used += n;
+    buf->data[buf->used] = 0;
+    if ((ptrdiff_t)n < room) {
+      return ferror(stream) == 0;
+    }
   }
 }
 
 ptrdiff_t sbuf_remaining(Sbuf *buf)
 {
   assert(buf!=0);
-  ptrdiff_t remaining = SBUF_SIZE - buf->used - 1;
-  return remaining;
+  return buf->cap ? buf->cap - buf->used - 1 : 0;
 }
 
 void sbuf_fputs(Sbuf *buf, FILE* stream)
 {
   assert(buf!=0);
   assert(stream!=0);
-  fputs(buf->data, stream);
+  if (buf->data != 0) {
+    fwrite(buf->data, 1, buf->used, stream);
+  }
   fflush(stream);
 }
 
 void sbuf_reset(Sbuf *buf)
 {
   assert(buf!=0);
-  memset(buf->data, 0, SBUF_SIZE);
+  if (buf->data != 0) {
+    buf->data[0] = 0;
+  }
   buf->used = 0;
   buf->error = false;
 }
+
+void sbuf_free(Sbuf *buf)
+{
+  assert(buf!=0);
+  free(buf->data);
+  buf->data = 0;
+  buf->used = buf->cap = 0;
+  buf->error = false;
+}
@@ -5,33 +5,35 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-28 23:49:02 +0200
-// Last modified: 2026-02-22T11:28:46+0100
+// Last modified: 2026-10-20T11:32:40+0200
 
 // Simple string buffer.
 // Mostly conceived for assembling strings.
-// Change the definition of SBUF_SIZE if you need longer strings.
-// For general allocation, use an arena instead!
+// The data lives in a single block that grows by doubling, up to SBUF_MAX
+// bytes. Resetting keeps the block, so a buffer that is re-used stops
+// allocating once it is large enough. Release it with sbuf_free.
 
 #pragma once
 
 #include <stddef.h>  // for ptrdiff_t
 #include <stdbool.h> // for bool
 #include <stdio.h>   // for FILE*
-#include <limits.h>  // for PATH_MAX
 
-#define SBUF_SIZE PATH_MAX
+#define SBUF_MIN 256
+#define SBUF_MAX (16*1024*1024)
 
 typedef struct {
+  char *data;      // Null-terminated; 0 until something is appended.
   ptrdiff_t used;
+  ptrdiff_t cap;   // Size of the block “data” points to.
   bool error;  // use “error” instead of “ok” so a zerod-out Sbuf is valid.
-  char data[SBUF_SIZE];
 } Sbuf;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// All appends set “error” to “true” if there is not enough space.
+// All appends set “error” to “true” if there is not enough memory.
 // All appends immediately return if “error” is “true”.
 
 // Appends at most “len” bytes to “buf” from “str”.
@@ -43,15 +45,22 @@ extern void sbuf_appends(Sbuf *buf, const char *str);
 // Appends using *printf.
 extern void sbuf_printf(Sbuf *buf, const char *fmt, ...);
 
-// Returns how much space remains in the buffer “buf”.
+// Appends the rest of “stream”, read in large blocks.
+// Returns false on a read error, or if there is not enough memory.
+extern bool sbuf_fread(Sbuf *buf, FILE *stream);
+
+// Returns how much space remains in the buffer “buf” before it has to grow.
 extern ptrdiff_t sbuf_remaining(Sbuf *buf);
 
 // Writes the buffer to the designated stream, and flushes the stream.
 extern void sbuf_fputs(Sbuf *buf, FILE* stream);
 
-// Empty the buffer.
+// Empty the buffer. This does not release or clear the memory.
 extern void sbuf_reset(Sbuf *buf);
 
+// Release the memory. The buffer can be used again afterwards.
+extern void sbuf_free(Sbuf *buf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,267 @@
+// file: bench-gui.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-20 20:31:17 +0200
+// Last modified: 2026-10-24T12:03:19+0200
+
+// Measure the time to render GUI frames, without a display.
+// Each layout is driven by a scripted mouse for a fixed number of frames,
+// once redrawing only what changed, once redrawing everything, and once
+// redrawing everything in tiles on a pool of workers. A frame painted in
+// tiles must be identical to one painted by a single thread, and an edit
+// box under the mouse must leave 'q' to quit.
+// The output only contains results, so that runs can be compared with diff.
+// Build and run with “make bench-gui”.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cairo-imgui.h"
+
+#define FRAMES 1000
+#define WARMUP 10
+
+typedef struct {
+  const char *name;
+  int32_t width, height;
+  void (*draw)(GUI_context *c);
+} Layout;
+
+static int64_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *profile_name(void *data, int32_t index)
+{
+  static char name[16];
+  (void)data;
+  snprintf(name, sizeof(name), "profile %d", index);
+  return name;
+}
+
+// The main window of x-razer, with 500 profiles.
+static void xrazer(GUI_context *c)
+{
+  static int red = 10, green = 20, blue = 30, radio = 1;
+  static GUI_hsv hsv = {210.0, 0.67, 0.12};
+  static const char *btns[2] = {"light", "dark"};
+  char buf[3][8];
+  gui_label(c, 10, 24, "Red");
+  gui_label(c, 10, 54, "Green");
+  gui_label(c, 10, 84, "Blue");
+  static GUI_gradient ramps[3];
+  double r = red / 255.0, g = green / 255.0, b = blue / 255.0;
+  ramps[0].from = (GUI_rgb){0.0, g, b};
+  ramps[0].to = (GUI_rgb){1.0, g, b};
+  ramps[1].from = (GUI_rgb){r, 0.0, b};
+  ramps[1].to = (GUI_rgb){r, 1.0, b};
+  ramps[2].from = (GUI_rgb){r, g, 0.0};
+  ramps[2].to = (GUI_rgb){r, g, 1.0};
+  gui_slider_gradient(c, 60, 20, &red, &ramps[0]);
+  gui_slider_gradient(c, 60, 50, &green, &ramps[1]);
+  gui_slider_gradient(c, 60, 80, &blue, &ramps[2]);
+  if (gui_colorwheel(c, 496, 10, 96, &hsv)) {
+    GUI_rgb rgb;
+    gui_hsv_to_rgb(&hsv, &rgb);
+    red = rgb.r * 255;
+    green = rgb.g * 255;
+    blue = rgb.b * 255;
+  }
+  snprintf(buf[0], sizeof(buf[0]), "%d", red);
+  snprintf(buf[1], sizeof(buf[1]), "%d", green);
+  snprintf(buf[2], sizeof(buf[2]), "%d", blue);
+  gui_label(c, 355, 24, buf[0]);
+  gui_label(c, 355, 54, buf[1]);
+  gui_label(c, 355, 84, buf[2]);
+  GUI_rgb sample = {red / 255.0, green / 255.0, blue / 255.0};
+  gui_colorsample(c, 390.0, 10.0, 100.0, 100.0, &sample);
+  gui_button(c, 10, 120, "Close");
+  gui_label(c, 90, 105, "Theme");
+  gui_radiobuttons(c, 90, 120, 2, btns, &radio);
+  gui_label(c, 160, 150, "BlackWidow V3");
+  gui_button(c, 400, 120, "Apply");
+  gui_label(c, 10, 174, "Profile");
+  static GUI_liststate list;
+  gui_listbox(c, 70, 165, 250, 5, 500, profile_name, 0, &list);
+}
+
+// A grid of 400 buttons.
+static void buttons(GUI_context *c)
+{
+  static const char *names[4] = {"Open", "Save", "Apply", "Close"};
+  for (int r = 0; r < 20; r++) {
+    for (int k = 0; k < 20; k++) {
+      gui_button(c, 5 + 60 * k, 5 + 35 * r, names[(r + k) % 4]);
+    }
+  }
+}
+
+// Columns of labels, sliders, checkboxes, spinners and colors; 480 widgets.
+static void mixed(GUI_context *c)
+{
+  static int values[4][30];
+  static bool checks[4][30];
+  static int32_t spins[4][30];
+  for (int col = 0; col < 4; col++) {
+    for (int r = 0; r < 30; r++) {
+      double x = 5 + 470 * col, y = 5 + 25 * r;
+      char label[16];
+      snprintf(label, sizeof(label), "Item %d", 30 * col + r);
+      gui_checkbox(c, x, y, label, &checks[col][r]);
+      gui_slider(c, x + 90, y, &values[col][r]);
+      gui_ispinner(c, x + 360, y, 0, 99, &spins[col][r]);
+      GUI_rgb color = {values[col][r] / 255.0, r / 30.0, col / 4.0};
+      gui_colorsample(c, x + 440, y, 20, 20, &color);
+    }
+  }
+}
+
+static const Layout layouts[] = {
+  {"x-razer", 620, 300, xrazer},
+  {"buttons", 1210, 710, buttons},
+  {"mixed", 1880, 760, mixed},
+};
+
+static int compare(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Render FRAMES frames of a layout, and print the percentiles in µs.
+static void run(const Layout *l, const char *mode, int32_t workers,
+                int64_t *times)
+{
+  static GUI_context c = {0};
+  bool full = strcmp(mode, "damage") != 0;
+  gui_theme_dark(&c);
+  c.workers = workers;
+  int64_t pixels = 0;
+  for (int k = 0; k < WARMUP + FRAMES; k++) {
+    // Sweep the mouse over the window in rows, with a drag every so often.
+    int32_t step = k % 200;
+    c.mouse_x = step * l->width / 200;
+    c.mouse_y = (k / 200 * 37 + 12) % l->height;
+    c.button_pressed = step >= 40 && step < 60;
+    c.button_released = step == 60;
+    c.full = full;
+    int64_t start = now();
+    gui_begin_offscreen(l->width, l->height, &c);
+    l->draw(&c);
+    gui_end(&c);
+    if (k >= WARMUP) {
+      times[k - WARMUP] = now() - start;
+      pixels += c.pixels;
+    }
+  }
+  gui_close(&c);
+  memset(&c, 0, sizeof(c));
+  qsort(times, FRAMES, sizeof(int64_t), compare);
+  printf("%-8s %-6s %6d %9.1f %9.1f %9.1f %9.1f %10lld\n", l->name,
+         mode, FRAMES, times[FRAMES / 2] / 1e3,
+         times[FRAMES * 9 / 10] / 1e3, times[FRAMES * 99 / 100] / 1e3,
+         times[FRAMES - 1] / 1e3, (long long)(pixels / FRAMES));
+}
+
+// Paint a frame of a layout with and without workers, and compare.
+static bool identical(const Layout *l, int32_t workers)
+{
+  static GUI_context c[2] = {{0}};
+  bool same = true;
+  for (int k = 0; k < 2; k++) {
+    gui_theme_dark(&c[k]);
+    c[k].workers = k * workers;
+    c[k].mouse_x = l->width / 2;
+    c[k].mouse_y = l->height / 2;
+    gui_begin_offscreen(l->width, l->height, &c[k]);
+    l->draw(&c[k]);
+    gui_end(&c[k]);
+  }
+  for (int32_t y = 0; y < l->height; y++) {
+    if (memcmp(c[0].canvas + y * c[0].stride, c[1].canvas + y * c[1].stride,
+               4 * l->width) != 0) {
+      same = false;
+    }
+  }
+  for (int k = 0; k < 2; k++) {
+    gui_close(&c[k]);
+    memset(&c[k], 0, sizeof(c[k]));
+  }
+  return same;
+}
+
+// Returns true if pressing 'q' would quit.
+static bool q_quits(GUI_context *c)
+{
+  SDL_Event ev = {.type = SDL_EVENT_KEY_DOWN};
+  ev.key.key = 'q';
+  return gui_process_events(c, &ev) == SDL_APP_SUCCESS;
+}
+
+// An edit box under the mouse must not take the keys, so that 'q' still
+// quits. After a click in it, 'q' is text.
+static bool hover_keeps_keys(void)
+{
+  static GUI_context c = {0};
+  GUI_editstate state = {0};
+  bool ok = true;
+  gui_theme_dark(&c);
+  c.mouse_x = 20;
+  c.mouse_y = 20;
+  for (int k = 0; k < 3; k++) {
+    c.button_pressed = k == 2;
+    gui_begin_offscreen(200, 50, &c);
+    gui_editbox(&c, 10, 10, 150, &state);
+    gui_end(&c);
+    if (q_quits(&c) != (k < 2)) {
+      ok = false;
+    }
+  }
+  gui_edit_free(&state);
+  gui_close(&c);
+  memset(&c, 0, sizeof(c));
+  return ok;
+}
+
+int main(void)
+{
+  static int64_t times[FRAMES];
+  int32_t workers = SDL_GetNumLogicalCPUCores() - 1;
+  if (workers < 1) {
+    workers = 1;
+  } else if (workers > GUI_MAXWORKERS) {
+    workers = GUI_MAXWORKERS;
+  }
+  int status = 0;
+  printf("# %d workers\n", workers);
+  printf("%-8s %-6s %6s %9s %9s %9s %9s %10s\n", "layout", "redraw", "frames",
+         "p50_us", "p90_us", "p99_us", "max_us", "pixels");
+  for (size_t k = 0; k < sizeof(layouts) / sizeof(layouts[0]); k++) {
+    run(&layouts[k], "damage", 0, times);
+    run(&layouts[k], "full", 0, times);
+    run(&layouts[k], "tiles", workers, times);
+  }
+  for (size_t k = 0; k < sizeof(layouts) / sizeof(layouts[0]); k++) {
+    bool same = identical(&layouts[k], workers);
+    printf("# %-8s tiles %s\n", layouts[k].name,
+           same ? "identical" : "differ");
+    if (same == false) {
+      status = 1;
+    }
+  }
+  bool keys = hover_keeps_keys();
+  printf("# editbox  hover %s 'q'\n", keys ? "keeps" : "swallows");
+  if (keys == false) {
+    status = 1;
+  }
+  return status;
+}
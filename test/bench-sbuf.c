@@ -0,0 +1,172 @@
+// file: bench-sbuf.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-20 12:21:08 +0200
+// Last modified: 2026-10-20T12:40:55+0200
+
+// Compare the growable Sbuf with the previous fixed-size version.
+// Compile with “cc -std=c11 -O2 -I.. -o bench-sbuf bench-sbuf.c ../sbuf.c”
+
+#define _DEFAULT_SOURCE
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sbuf.h"
+
+#define ROUNDS 1000000
+
+// The previous implementation; a PATH_MAX array that is cleared on reset.
+typedef struct {
+  ptrdiff_t used;
+  bool error;
+  char data[PATH_MAX];
+} Oldbuf;
+
+static void old_append(Oldbuf *buf, const char *str, const ptrdiff_t len)
+{
+  if (buf->error == true) {
+    return;
+  }
+  ptrdiff_t alen = strnlen(str, len);
+  ptrdiff_t remaining = PATH_MAX - buf->used - 1;
+  if (len < remaining) {
+    memcpy(buf->data+buf->used, str, alen);
+    buf->used += alen;
+  } else {
+    buf->error = true;
+  }
+}
+
+static void old_appends(Oldbuf *buf, const char *str)
+{
+  if (buf->error == true) {
+    return;
+  }
+  ptrdiff_t remaining = PATH_MAX - buf->used - 1;
+  old_append(buf, str, strnlen(str, remaining));
+}
+
+static void old_printf(Oldbuf *buf, const char *fmt, ...)
+{
+  if (buf->error == true) {
+    return;
+  }
+  ptrdiff_t remaining = PATH_MAX - buf->used - 1;
+  va_list ap;
+  va_start(ap, fmt);
+  ptrdiff_t used = vsnprintf(buf->data+buf->used, remaining, fmt, ap);
+  va_end(ap);
+  if (used > remaining) {
+    memset(buf->data+buf->used, 0, remaining);
+    buf->error = true;
+  } else {
+    buf->used += used;
+  }
+}
+
+static void old_reset(Oldbuf *buf)
+{
+  memset(buf->data, 0, PATH_MAX);
+  buf->used = 0;
+  buf->error = false;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start, int rounds, size_t check)
+{
+  double ns = (now() - start) * 1e9 / rounds;
+  printf("  %-30s %8.1f ns/op  (%zu)\n", name, ns, check);
+}
+
+int main(void)
+{
+  const char *home = "/home/someone";
+  size_t check = 0;
+  double start;
+  puts("building a path, as read_rc does:");
+  start = now();
+  for (int k = 0; k < ROUNDS; k++) {
+    Oldbuf buf = {0};
+    old_appends(&buf, home);
+    old_appends(&buf, "/.x-razerrc");
+    check += buf.used;
+  }
+  report("old, zeroed on the stack", start, ROUNDS, check);
+  check = 0;
+  start = now();
+  for (int k = 0; k < ROUNDS; k++) {
+    Sbuf buf = {0};
+    sbuf_appends(&buf, home);
+    sbuf_appends(&buf, "/.x-razerrc");
+    check += buf.used;
+    sbuf_free(&buf);
+  }
+  report("new, allocated and freed", start, ROUNDS, check);
+  puts("re-using a buffer with reset:");
+  static Oldbuf old;
+  check = 0;
+  start = now();
+  for (int k = 0; k < ROUNDS; k++) {
+    old_reset(&old);
+    old_printf(&old, "color %d %d %d\n", k & 255, (k >> 8) & 255, 7);
+    check += old.used;
+  }
+  report("old", start, ROUNDS, check);
+  Sbuf buf = {0};
+  check = 0;
+  start = now();
+  for (int k = 0; k < ROUNDS; k++) {
+    sbuf_reset(&buf);
+    sbuf_printf(&buf, "color %d %d %d\n", k & 255, (k >> 8) & 255, 7);
+    check += buf.used;
+  }
+  report("new", start, ROUNDS, check);
+  puts("reading a file:");
+  char name[] = "/tmp/bench-sbuf-XXXXXX";
+  FILE *f = fdopen(mkstemp(name), "w+");
+  if (f == 0) {
+    perror("bench-sbuf");
+    return 1;
+  }
+  for (int k = 0; k < 2000; k++) {
+    fprintf(f, "%d %d %d\n", k & 255, 17, 33);
+  }
+  long size = ftell(f);
+  check = 0;
+  start = now();
+  for (int k = 0; k < ROUNDS / 100; k++) {
+    rewind(f);
+    old_reset(&old);
+    old.used = fread(old.data, 1, PATH_MAX, f);
+    check += old.used;
+  }
+  report("old, truncated", start, ROUNDS / 100, check);
+  check = 0;
+  start = now();
+  for (int k = 0; k < ROUNDS / 100; k++) {
+    rewind(f);
+    sbuf_reset(&buf);
+    sbuf_fread(&buf, f);
+    check += buf.used;
+  }
+  report("new, whole file", start, ROUNDS / 100, check);
+  printf("file size %ld bytes\n", size);
+  sbuf_free(&buf);
+  fclose(f);
+  remove(name);
+  return 0;
+}
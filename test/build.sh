@@ -1,2 +1,3 @@
 #!/bin/sh
 cc -std=c11 -o razer-get-serial razer-get-serial.c -lusb
+cc -std=c11 -O2 -I.. -o bench-sbuf bench-sbuf.c ../sbuf.c
@@ -5,38 +5,466 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-18 14:53:46 +0200
-// Last modified: 2025-08-28T21:10:31+0200
+// Last modified: 2026-10-24T15:31:12+0200
 
 #include "cairo-imgui.h"
+#include "ipc.h"
+#include "metrics.h"
+#include "profile.h"
 #include "razer-usb.h"
 #include "rc.h"
 
 #include <assert.h>
+#include <math.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #define SDL_MAIN_USE_CALLBACKS 1
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <cairo/cairo.h>
 
+#define MAXPHASES 8
+// Size of the window.
+#define WIDTH 620
+#define HEIGHT 300
+
+// Startup phases, in ns since the start of SDL_AppInit.
+typedef struct {
+  const char *name[MAXPHASES];
+  Uint64 ns[MAXPHASES];
+  int count;
+} Trace;
+
+// Results of the background initialization.
+typedef struct {
+  RC_data clr;
+  USB_data kb;
+  int daemon;
+  Profiles profiles;
+  Uint64 start;
+  Trace trace;
+} Init;
+
 typedef struct {
   SDL_Window *window;
   SDL_Renderer *renderer;
-  SDL_Texture *texture;
   GUI_context *ctx;
-  RC_data clr;
+  RC_data clr;      // Shown; the sliders change it before it is applied.
+  RC_data applied;  // Last color sent to the keyboard, and written.
   USB_data kb;
+  int daemon;  // Socket connected to x-razerd, or -1.
+  Profiles profiles;
+  int32_t profile;  // Selected profile, or -1.
+  GUI_liststate list;  // Of the profiles.
+  SDL_Thread *init_thread;
+  SDL_AtomicInt init_done;
+  bool ready;  // The results of the initialization are in this struct.
+  Init init;
+  Trace trace;
+  bool timing;  // Print the startup timing.
+  RC_watch watch;
+  SDL_Thread *watcher;
+  int watch_stop[2];  // Written to stop the watcher.
+  Uint32 rc_event;    // Pushed when the RC file has changed, or 0.
+  Uint32 wake_event;  // Pushed by other threads to request a redraw, or 0.
+  SDL_TimerID metrics_timer;  // Writes the metrics file, or 0.
+  bool busy;          // Drawing at a fixed rate instead of waiting for events.
+  FILE *record;       // The input of every frame is written here, or 0.
+  FILE *replay;       // Frames are drawn from the input in here, or 0.
+  int64_t nreplayed;  // Frames drawn from the replay file.
+  Uint64 replay_ns;   // Time spent drawing them.
+  GUI_gradient ramps[3];  // Of the red, green and blue sliders.
 } State;
 
+static void trace(Trace *t, Uint64 start, const char *name)
+{
+  if (t->count < MAXPHASES) {
+    t->name[t->count] = name;
+    t->ns[t->count++] = SDL_GetTicksNS() - start;
+  }
+}
+
+static void print_trace(const char *title, const Trace *t)
+{
+  fprintf(stderr, "%s:\n", title);
+  Uint64 prev = 0;
+  for (int k = 0; k < t->count; k++) {
+    fprintf(stderr, "  %-14s %8.2f ms (+%.2f)\n", t->name[k],
+            t->ns[k] / 1e6, (t->ns[k] - prev) / 1e6);
+    prev = t->ns[k];
+  }
+}
+
+// Read the RC file and open the keyboard, off the main thread.
+static int init_thread(void *data)
+{
+  State *s = data;
+  Init *in = &s->init;
+  read_rc(&in->clr);
+  trace(&in->trace, in->start, "read rc");
+  profiles_open(&in->profiles);
+  trace(&in->trace, in->start, "profiles");
+  // Use the daemon if it is running, otherwise initialize USB.
+  in->daemon = ipc_connect();
+  if (in->daemon >= 0) {
+    char reply[IPC_LINE];
+    if (ipc_request(in->daemon, "status", reply, sizeof(reply))) {
+      // Skip “ok R G B detail ID ” to get to the product name.
+      char *name = reply;
+      for (int k = 0; k < 6 && name != 0; k++) {
+        name = strchr(name + 1, ' ');
+      }
+      snprintf(in->kb.product_name, sizeof(in->kb.product_name), "%s",
+               name ? name + 1 : "x-razerd");
+      // Profiles can have a color per product.
+      unsigned id;
+      if (sscanf(reply, "ok %*d %*d %*d %*s %x", &id) == 1) {
+        in->kb.product_id = id;
+      }
+    }
+    trace(&in->trace, in->start, "daemon");
+  } else {
+    usb_init(&in->kb);
+    // Here, so that the first frame of a profile is not delayed by it.
+    if (in->kb.handle != 0) {
+      usb_calibrate(&in->kb);
+    }
+    trace(&in->trace, in->start, "usb init");
+  }
+  SDL_SetAtomicInt(&s->init_done, 1);
+  // Dropped if SDL is not initialized yet; the first frame sees init_done.
+  SDL_Event ev = {.type = s->wake_event};
+  SDL_PushEvent(&ev);
+  return 0;
+}
+
+// Called by the RC writer thread, to show its status.
+static void rc_written(RC_status status, void *arg)
+{
+  State *s = arg;
+  (void)status;
+  SDL_Event ev = {.type = s->wake_event};
+  SDL_PushEvent(&ev);
+}
+
+// Write the metrics file from a timer, since SDL_AppIterate does not run
+// while the GUI is idle.
+static Uint32 write_metrics(void *data, SDL_TimerID id, Uint32 interval)
+{
+  (void)data;
+  (void)id;
+  metrics_write(getenv("X_RAZER_METRICS"), "x-razer");
+  return interval;
+}
+
+// Wait for events when idle, but draw at a fixed rate while the mouse
+// button is held or the keyboard is being connected.
+static void set_rate(State *s)
+{
+  if (s->replay != 0) {
+    return;
+  }
+  bool busy = s->ctx->button_pressed || s->ready == false;
+  if (busy != s->busy) {
+    s->busy = busy;
+    SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, busy ? "60" : "waitevent");
+  }
+}
+
+// Write a color that was not set with the GUI to the record file.
+static void record_color(State *s)
+{
+  if (s->record != 0) {
+    fprintf(s->record, "color %d %d %d\n", s->clr.red, s->clr.green,
+            s->clr.blue);
+  }
+}
+
+// Read the replay file up to the input of the next frame, and set the
+// colors found on the way. Returns false at the end of the file.
+static bool replay_input(State *s)
+{
+  char line[80];
+  while (fgets(line, sizeof(line), s->replay) != 0) {
+    int r, g, b;
+    if (sscanf(line, "color %d %d %d", &r, &g, &b) == 3) {
+      s->clr.red = r;
+      s->clr.green = g;
+      s->clr.blue = b;
+    } else if (gui_replay(s->ctx, line)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// FNV-1a hash of the pixels in the window, to compare replays.
+static uint64_t canvas_hash(const GUI_context *ctx)
+{
+  uint64_t h = 14695981039346656037u;
+  for (int32_t y = 0; y < ctx->height; y++) {
+    const unsigned char *row = ctx->canvas + y * ctx->stride;
+    for (int32_t x = 0; x < 4 * ctx->width; x++) {
+      h = (h ^ row[x]) * 1099511628211u;
+    }
+  }
+  return h;
+}
+
+// Publish the results of the background initialization to the state.
+static void init_finish(State *s)
+{
+  SDL_WaitThread(s->init_thread, 0);
+  s->init_thread = 0;
+  s->clr = s->init.clr;
+  s->kb = s->init.kb;
+  s->daemon = s->init.daemon;
+  s->profiles = s->init.profiles;
+  s->applied = s->clr;
+  s->ready = true;
+  record_color(s);
+}
+
+// Wait for changes of the RC file, and wake up the event loop for them,
+// until something is written to watch_stop.
+static int watch_thread(void *data)
+{
+  State *s = data;
+  while (s->watch.fd >= 0 && s->watch.error == false) {
+    struct pollfd fds[2] = {
+      {.fd = s->watch.fd, .events = POLLIN},
+      {.fd = s->watch_stop[0], .events = POLLIN},
+    };
+    if (poll(fds, 2, -1) < 0 || fds[1].revents != 0) {
+      break;
+    }
+    if ((fds[0].revents & POLLIN) && rc_watch_changed(&s->watch)) {
+      SDL_Event ev = {.type = s->rc_event};
+      SDL_PushEvent(&ev);
+    }
+  }
+  // The watch is closed by SDL_AppQuit.
+  if (s->watch.error) {
+    fputs("x-razer: stopped watching the RC file\n", stderr);
+  }
+  return 0;
+}
+
+// Send the current color to the keyboard.
+static void send_color(State *s)
+{
+  if (s->daemon >= 0) {
+    char cmd[40], reply[IPC_LINE];
+    snprintf(cmd, sizeof(cmd), "color %d %d %d",
+             s->clr.red, s->clr.green, s->clr.blue);
+    if (ipc_request(s->daemon, cmd, reply, sizeof(reply)) == false) {
+      s->kb.errormsg = "Lost connection to x-razerd.";
+    }
+  } else {
+    usb_set_color(&s->kb, s->clr.red, s->clr.green, s->clr.blue);
+  }
+  s->applied = s->clr;
+}
+
+// Re-read the RC file after it changed, and apply a new color.
+static void reload_rc(State *s)
+{
+  RC_data clr;
+  read_rc(&clr);
+  // Our own writes give the color that was applied. Compare with that, not
+  // with the shown color, which the sliders may have changed since.
+  if (clr.ok == false || s->ready == false ||
+      (clr.red == s->applied.red && clr.green == s->applied.green &&
+       clr.blue == s->applied.blue)) {
+    return;
+  }
+  s->clr = clr;
+  record_color(s);
+  send_color(s);
+}
+
+static const char *profile_name(void *data, int32_t index)
+{
+  const Profile *prof = profiles_get(data, index);
+  return prof ? prof->name : "";
+}
+
+// Set profile number “index” on the keyboard, and show its color.
+static void select_profile(State *s, int32_t index)
+{
+  const Profile *prof = profiles_get(&s->profiles, index);
+  if (prof == 0) {
+    return;
+  }
+  s->profile = index;
+  uint8_t rgb[3];
+  profile_color(prof, s->kb.product_id, rgb);
+  s->clr.red = rgb[0];
+  s->clr.green = rgb[1];
+  s->clr.blue = rgb[2];
+  if (s->daemon >= 0) {
+    char cmd[IPC_LINE], reply[IPC_LINE];
+    snprintf(cmd, sizeof(cmd), "load %s", prof->name);
+    if (ipc_request(s->daemon, cmd, reply, sizeof(reply)) == false) {
+      s->kb.errormsg = "Lost connection to x-razerd.";
+    }
+  } else {
+    profile_apply(prof, &s->kb);
+  }
+  s->applied = s->clr;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: x-razer [--set R G B | --apply-rc | --profile NAME "
+          "| --timing\n"
+          "                | --record FILE | --replay FILE]\n"
+          "  --set R G B     set the color (0–255 per channel) and exit.\n"
+          "  --apply-rc      set the color from ~/.x-razerrc and exit.\n"
+          "  --profile NAME  set a profile from ~/.x-razer-profiles and exit.\n"
+          "  --timing        start the GUI and print the startup timing.\n"
+          "  --record FILE   start the GUI and write its input to FILE.\n"
+          "  --replay FILE   draw the input from FILE without a window, and\n"
+          "                  print the time it took.\n"
+          "Without arguments, the GUI is started.\n");
+}
+
+// Parse a color channel. Returns -1 if it is not a number in [0, 255].
+static int channel(const char *str)
+{
+  char *end;
+  long val = strtol(str, &end, 10);
+  if (end == str || *end != 0 || val < 0 || val > 255) {
+    return -1;
+  }
+  return val;
+}
+
+// Handle the subcommands that don't need SDL or Cairo.
+// Returns -1 if the GUI should be started, otherwise the exit status.
+static int run_cli(int argc, char **argv)
+{
+  RC_data clr = {0};
+  const char *profile = 0;
+  if (argc < 2 || (argc == 2 && strcmp(argv[1], "--timing") == 0)) {
+    return -1;
+  }
+  if (argc == 3 && (strcmp(argv[1], "--record") == 0 ||
+                    strcmp(argv[1], "--replay") == 0)) {
+    return -1;
+  }
+  if (strcmp(argv[1], "--set") == 0 && argc == 5) {
+    int rgb[3];
+    for (int k = 0; k < 3; k++) {
+      rgb[k] = channel(argv[2+k]);
+      if (rgb[k] < 0) {
+        fprintf(stderr, "x-razer: invalid color value “%s”\n", argv[2+k]);
+        return 1;
+      }
+    }
+    clr.red = rgb[0];
+    clr.green = rgb[1];
+    clr.blue = rgb[2];
+  } else if (strcmp(argv[1], "--apply-rc") == 0 && argc == 2) {
+    read_rc(&clr);
+    if (clr.ok == false) {
+      fputs("x-razer: could not read RC file\n", stderr);
+      return 1;
+    }
+  } else if (strcmp(argv[1], "--profile") == 0 && argc == 3) {
+    profile = argv[2];
+  } else {
+    usage();
+    return 1;
+  }
+  // Let the daemon set the color if it is running.
+  int fd = ipc_connect();
+  if (fd >= 0) {
+    char cmd[IPC_LINE], reply[IPC_LINE];
+    if (profile != 0) {
+      snprintf(cmd, sizeof(cmd), "load %s", profile);
+    } else {
+      snprintf(cmd, sizeof(cmd), "color %d %d %d", clr.red, clr.green, clr.blue);
+    }
+    bool ok = ipc_request(fd, cmd, reply, sizeof(reply));
+    close(fd);
+    if (ok == false) {
+      fprintf(stderr, "x-razer: daemon replied “%s”\n", reply);
+      return 1;
+    }
+    return 0;
+  }
+  Profiles profiles = {0};
+  const Profile *prof = 0;
+  if (profile != 0) {
+    profiles_open(&profiles);
+    prof = profiles_find(&profiles, profile);
+    if (prof == 0) {
+      if (profiles.errline > 0) {
+        fprintf(stderr, "x-razer: %s in line %d of ~/.x-razer-profiles\n",
+                profiles.error, profiles.errline);
+      } else {
+        fprintf(stderr, "x-razer: no profile “%s”\n", profile);
+      }
+      return 1;
+    }
+  }
+  USB_data kb = {0};
+  usb_init(&kb);
+  if (kb.errormsg != 0 || kb.handle == 0) {
+    fprintf(stderr, "x-razer: %s\n", kb.errormsg ? kb.errormsg :
+            "Could not open keyboard.");
+    usb_close(&kb);
+    usb_exit();
+    return 1;
+  }
+  bool ok;
+  if (prof != 0) {
+    ok = profile_apply(prof, &kb);
+  } else {
+    ok = usb_set_color(&kb, clr.red, clr.green, clr.blue);
+  }
+  profiles_close(&profiles);
+  usb_close(&kb);
+  usb_exit();
+  if (ok == false) {
+    fputs("x-razer: could not set the color\n", stderr);
+    return 1;
+  }
+  return 0;
+}
+
 
 SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
 {
-  (void)argc;
-  (void)argv;
-  // Detach if connected to a terminal.
-  if (isatty(fileno(stdout))) {
+  // Subcommands exit without touching SDL.
+  int status = run_cli(argc, argv);
+  if (status >= 0) {
+    exit(status);
+  }
+  // Initialize state needed in all functions.
+  static State s = {0};
+  s.init.start = SDL_GetTicksNS();
+  s.timing = argc == 2; // Only --timing gets here.
+  if (argc == 3) {
+    bool record = strcmp(argv[1], "--record") == 0;
+    FILE *f = fopen(argv[2], record ? "w" : "r");
+    if (f == 0) {
+      fprintf(stderr, "x-razer: could not open “%s”\n", argv[2]);
+      exit(1);
+    }
+    if (record) {
+      s.record = f;
+    } else {
+      s.replay = f;
+    }
+  }
+  // Detach if connected to a terminal, unless there is output to print.
+  if (s.timing == false && s.replay == 0 && isatty(fileno(stdout))) {
     pid_t pid = fork();
     if (pid == -1) {
       fprintf(stderr, "fork failed!\n");
@@ -44,15 +472,47 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
       exit(0);
     }
   }
-  // Initialize state needed in all functions.
-  static State s = {0};
   // Create GUI context.
   static GUI_context ctx = {0};
   s.ctx = &ctx;
-  // Read rcfile.
-  read_rc(&s.clr);
-  // Initialize USB.
-  usb_init(&s.kb);
+  s.daemon = -1;
+  s.profile = -1;
+  s.watch.fd = -1;
+  s.watch_stop[0] = s.watch_stop[1] = -1;
+  s.list.selected = -1;
+  ctx.dirty = true;
+  // Events are handled while Cairo draws the previous frame. On a single
+  // core that only adds a hand-off to every frame.
+  ctx.threaded = SDL_GetNumLogicalCPUCores() > 1;
+  // Large damaged areas are painted in tiles by the other cores.
+  ctx.workers = SDL_min(SDL_GetNumLogicalCPUCores() - 1, GUI_MAXWORKERS);
+  if (s.replay != 0) {
+    // No window, keyboard, daemon, profiles or RC file; only the input and
+    // the colors in the file determine what is drawn.
+    s.ready = true;
+    s.clr.ok = true;
+    snprintf(s.kb.product_name, sizeof(s.kb.product_name), "replay");
+    gui_theme_dark(&ctx);
+    *appstate = &s;
+    if (!SDL_Init(SDL_INIT_EVENTS)) {
+      SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
+      return SDL_APP_FAILURE;
+    }
+    // As fast as possible.
+    SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "0");
+    return SDL_APP_CONTINUE;
+  }
+  // Register events before any thread can push them.
+  s.rc_event = SDL_RegisterEvents(2);
+  s.wake_event = s.rc_event ? s.rc_event + 1 : 0;
+  // Read the rcfile and open the keyboard in the background, so the window
+  // can be shown while that happens.
+  s.init_thread = SDL_CreateThread(init_thread, "init", &s);
+  if (s.init_thread == 0) {
+    init_thread(&s);
+    init_finish(&s);
+  }
+  trace(&s.trace, s.init.start, "start");
   // Set a theme for the GUI.
   gui_theme_dark(&ctx);
   // Make context available to other callbacks.
@@ -61,11 +521,25 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
     SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
     return SDL_APP_FAILURE;
   }
-  // The SDL_AppIterate callback should run ≈10× per second.
-  SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "10");
+  trace(&s.trace, s.init.start, "SDL init");
+  // Watch the RC file in a thread that sleeps until it changes.
+  if (s.rc_event != 0 && rc_watch_open(&s.watch)) {
+    if (pipe(s.watch_stop) == 0) {
+      s.watcher = SDL_CreateThread(watch_thread, "watch", &s);
+    }
+    if (s.watcher == 0) {
+      rc_watch_close(&s.watch);
+    }
+  }
+  // SDL_AppIterate runs when there are events; see set_rate.
+  SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "waitevent");
+  const char *metrics = getenv("X_RAZER_METRICS");
+  if (metrics != 0 && *metrics != 0) {
+    s.metrics_timer = SDL_AddTimer(METRICS_INTERVAL * 1000, write_metrics, 0);
+  }
   // Create window and renderer.
-  int w = 500;
-  int h = 165;
+  int w = WIDTH;
+  int h = HEIGHT;
   if (!SDL_CreateWindowAndRenderer("x-razer", w, h, 0,
                                    &s.window, &s.renderer)) {
     SDL_Log("Couldn't create a window and renderer: %s", SDL_GetError());
@@ -73,9 +547,7 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
   }
   // Render on vsync to prevent tearing
   SDL_SetRenderVSync(s.renderer, SDL_RENDERER_VSYNC_ADAPTIVE);
-  // Create texture for cairo to render to.
-  s.texture = SDL_CreateTexture(s.renderer, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_STREAMING, w, h);
+  trace(&s.trace, s.init.start, "window");
   return SDL_APP_CONTINUE;
 }
 
@@ -83,8 +555,29 @@ SDL_AppResult SDL_AppIterate(void *appstate)
 {
   (void)appstate;
   State *s = appstate;
+  Uint64 start = SDL_GetTicksNS();
+  METRIC_ADD(wakeups, 1);
+  if (s->ready == false && SDL_GetAtomicInt(&s->init_done)) {
+    init_finish(s);
+    s->ctx->dirty = true;
+  }
+  set_rate(s);
+  if (s->replay != 0 && replay_input(s) == false) {
+    return SDL_APP_SUCCESS;
+  }
+  // Only draw when something has changed, and the previous frame is done.
+  if (s->ctx->dirty == false || s->ctx->hidden || gui_busy(s->ctx)) {
+    return SDL_APP_CONTINUE;
+  }
+  if (s->record != 0) {
+    gui_record(s->ctx, s->record);
+  }
   // GUI definition starts here.
-  gui_begin(s->renderer, s->texture, s->ctx);
+  if (s->replay != 0) {
+    gui_begin_offscreen(WIDTH, HEIGHT, s->ctx);
+  } else {
+    gui_begin(s->renderer, s->ctx);
+  }
   // RGB
   gui_label(s->ctx, 10, 24, "Red");
   gui_label(s->ctx, 10, 54, "Green");
@@ -98,18 +591,39 @@ SDL_AppResult SDL_AppIterate(void *appstate)
   samplecolor.g = (double)green/255.0;
   samplecolor.b = (double)blue/255.0;
   static char bred[10] = {0}, bgreen[10] = {0}, bblue[10] = {0};
-  if (gui_slider(s->ctx, 60, 20, &red)) {
+  // Each track shows the colors its slider can make with the other two.
+  s->ramps[0].from = (GUI_rgb){0.0, samplecolor.g, samplecolor.b};
+  s->ramps[0].to = (GUI_rgb){1.0, samplecolor.g, samplecolor.b};
+  s->ramps[1].from = (GUI_rgb){samplecolor.r, 0.0, samplecolor.b};
+  s->ramps[1].to = (GUI_rgb){samplecolor.r, 1.0, samplecolor.b};
+  s->ramps[2].from = (GUI_rgb){samplecolor.r, samplecolor.g, 0.0};
+  s->ramps[2].to = (GUI_rgb){samplecolor.r, samplecolor.g, 1.0};
+  if (gui_slider_gradient(s->ctx, 60, 20, &red, &s->ramps[0])) {
     samplecolor.r = (double)red/255.0;
     s->clr.red = red;
   }
-  if (gui_slider(s->ctx, 60, 50, &green)) {
+  if (gui_slider_gradient(s->ctx, 60, 50, &green, &s->ramps[1])) {
     samplecolor.g = (double)green/255.0;
     s->clr.green = green;
   }
-  if (gui_slider(s->ctx, 60, 80, &blue)) {
+  if (gui_slider_gradient(s->ctx, 60, 80, &blue, &s->ramps[2])) {
     samplecolor.b = (double)blue/255.0;
     s->clr.blue = blue;
   }
+  // The wheel keeps its own hue and saturation, since grays have neither.
+  static GUI_hsv hsv = {0};
+  GUI_rgb shown;
+  gui_hsv_to_rgb(&hsv, &shown);
+  if (lround(shown.r * 255) != red || lround(shown.g * 255) != green ||
+      lround(shown.b * 255) != blue) {
+    gui_rgb_to_hsv(&samplecolor, &hsv);
+  }
+  if (gui_colorwheel(s->ctx, 496, 10, 96, &hsv)) {
+    gui_hsv_to_rgb(&hsv, &samplecolor);
+    red = s->clr.red = lround(samplecolor.r * 255);
+    green = s->clr.green = lround(samplecolor.g * 255);
+    blue = s->clr.blue = lround(samplecolor.b * 255);
+  }
   snprintf(bred, 9, "%d", red);
   snprintf(bgreen, 9, "%d", green);
   snprintf(bblue, 9, "%d", blue);
@@ -139,28 +653,73 @@ SDL_AppResult SDL_AppIterate(void *appstate)
   //snprintf(buf, 79, "x = %d, y = %d", s->ctx->mouse_x, s->ctx->mouse_y);
   //gui_label(s->ctx, 180, 130, buf);
   // Show messages.
-  if (s->clr.ok == false) {
+  if (s->ready == false) {
+    gui_label(s->ctx, 160, 150, "Connecting…");
+  } else if (write_rc_status() == RC_FAILED) {
+    gui_label(s->ctx, 160, 130, "Could not write RC file!");
+  } else if (s->clr.ok == false && write_rc_status() != RC_WRITTEN) {
     gui_label(s->ctx, 160, 130, "Could not read RC file!");
   }
-  if (s->kb.errormsg != 0) {
+  if (s->ready == false) {
+    // Nothing to show yet.
+  } else if (s->kb.errormsg != 0) {
     gui_label(s->ctx, 160, 150, s->kb.errormsg);
   } else {
     gui_label(s->ctx, 160, 150, s->kb.product_name);
   }
   // Apply changes button
-  if (gui_button(s->ctx, 400, 120, "Apply")) {
-    usb_set_color(&s->kb, s->clr.red, s->clr.green, s->clr.blue);
-    write_rc(&s->clr);
+  if (s->ready && gui_button(s->ctx, 400, 120, "Apply")) {
+    send_color(s);
+    // Written in the background; repeated clicks give a single write.
+    if (s->replay == 0) {
+      write_rc_async(&s->clr, rc_written, s);
+    }
+  }
+  // Profiles
+  int32_t nprofiles = profiles_count(&s->profiles);
+  if (nprofiles > 0) {
+    gui_label(s->ctx, 10, 174, "Profile");
+    // The profiles are mapped once, so the index is only built once.
+    if (s->list.norder != nprofiles) {
+      gui_listbox_index(&s->list, nprofiles, profile_name, &s->profiles);
+    }
+    if (gui_listbox(s->ctx, 70, 165, 250, 5, nprofiles, profile_name,
+                    &s->profiles, &s->list)) {
+      select_profile(s, s->list.selected);
+    }
   }
-  // You can still draw to s->ctx here...
   // End of GUI definition
   gui_end(s->ctx);
+  if (s->trace.count == 3) {
+    trace(&s->trace, s->init.start, "first frame");
+  }
+  if (s->timing && s->ready) {
+    print_trace("main thread", &s->trace);
+    print_trace("background", &s->init.trace);
+    s->timing = false;
+  }
+  METRIC_ADD(frames, 1);
+  METRIC_ADD(frame_ns, SDL_GetTicksNS() - start);
+  METRIC_ADD(pixels, s->ctx->pixels);
+  METRIC_ADD(gui_allocs, s->ctx->allocs);
+  if (s->replay != 0) {
+    s->nreplayed++;
+    s->replay_ns += SDL_GetTicksNS() - start;
+  }
   return SDL_APP_CONTINUE;
 }
 
 SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
 {
   State *s = appstate;
+  if (s->rc_event != 0 && event->type == s->rc_event) {
+    reload_rc(s);
+    s->ctx->dirty = true;
+    return SDL_APP_CONTINUE;
+  } else if (s->wake_event != 0 && event->type == s->wake_event) {
+    s->ctx->dirty = true;
+    return SDL_APP_CONTINUE;
+  }
   return gui_process_events(s->ctx, event);
 }
 
@@ -169,8 +728,49 @@ void SDL_AppQuit(void *appstate, SDL_AppResult result)
   State *s = appstate;
   (void)result;
   // Clean up.
-  usb_exit();
-  SDL_DestroyTexture(s->texture);
+  if (s->watcher != 0) {
+    ssize_t n = write(s->watch_stop[1], "", 1);
+    (void)n;
+    SDL_WaitThread(s->watcher, 0);
+  }
+  for (int k = 0; k < 2; k++) {
+    if (s->watch_stop[k] >= 0) {
+      close(s->watch_stop[k]);
+    }
+  }
+  rc_watch_close(&s->watch);
+  write_rc_flush();
+  if (s->init_thread != 0) {
+    init_finish(s);
+  }
+  if (s->daemon >= 0) {
+    close(s->daemon);
+  } else {
+    usb_close(&s->kb);
+    usb_exit();
+  }
+  profiles_close(&s->profiles);
+  if (s->metrics_timer != 0) {
+    SDL_RemoveTimer(s->metrics_timer);
+  }
+  if (getenv("X_RAZER_METRICS") != 0) {
+    metrics_write(getenv("X_RAZER_METRICS"), "x-razer");
+  }
+  if (s->record != 0) {
+    fclose(s->record);
+  }
+  if (s->replay != 0) {
+    printf("replayed %lld frames in %.3f ms, %.1f µs per frame, "
+           "canvas %016llx\n", (long long)s->nreplayed, s->replay_ns / 1e6,
+           s->nreplayed ? s->replay_ns / 1e3 / s->nreplayed : 0.0,
+           (unsigned long long)canvas_hash(s->ctx));
+    fclose(s->replay);
+  }
+  gui_close(s->ctx);  // Waits for the render thread, that paints the ramps.
+  for (int k = 0; k < 3; k++) {
+    gui_gradient_free(&s->ramps[k]);
+  }
+  gui_listbox_free(&s->list);
   SDL_DestroyWindow(s->window);
   SDL_DestroyRenderer(s->renderer);
 }
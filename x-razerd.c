@@ -0,0 +1,356 @@
+// file: x-razerd.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-18 21:44:52 +0200
+// Last modified: 2026-10-24T13:10:42+0200
+
+// Daemon that owns the keyboard, and accepts commands over a Unix socket.
+// See ipc.h for the protocol.
+// Commands are coalesced; only the latest color or frame is sent, at the
+// rate allowed by the governor in razer-usb.c.
+
+#include "ipc.h"
+#include "metrics.h"
+#include "profile.h"
+#include "razer-usb.h"
+#include "rc.h"
+#include "sbuf.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAXCLIENTS 16
+
+typedef struct {
+  int fd;
+  ptrdiff_t used;
+  char line[IPC_LINE];
+} Client;
+
+typedef enum {
+  NONE,
+  COLOR,
+  FRAME,
+} Pending;
+
+typedef struct {
+  USB_data kb;
+  RC_data clr;   // Last color that was sent.
+  Pending pending;
+  uint8_t color[3];
+  uint8_t frame[USB_MAXROWS*USB_MAXCOLS*3];
+  Client clients[MAXCLIENTS];
+  int nclients;
+  Profiles profiles;
+  RC_watch watch;
+} Daemon;
+
+static volatile sig_atomic_t done = 0;
+
+static void stop(int sig)
+{
+  (void)sig;
+  done = 1;
+}
+
+static int hexval(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Open the keyboard if that has not succeeded yet, for instance because it
+// was plugged in after the daemon started. Otherwise write an error to
+// “reply”, so that a command is not acknowledged and then dropped.
+static bool need_keyboard(Daemon *d, Sbuf *reply)
+{
+  if (d->kb.handle == 0) {
+    usb_close(&d->kb);
+    usb_exit();
+    usb_init(&d->kb);
+    if (d->kb.errormsg != 0) {
+      fprintf(stderr, "x-razerd: %s\n", d->kb.errormsg);
+    }
+  }
+  if (d->kb.handle == 0) {
+    sbuf_appends(reply, "error no keyboard\n");
+    return false;
+  }
+  return true;
+}
+
+// Execute a single command line, and write the reply to “reply”.
+static void execute(Daemon *d, char *line, Sbuf *reply)
+{
+  if ((strncmp(line, "color ", 6) == 0 || strncmp(line, "frame ", 6) == 0 ||
+       strncmp(line, "load", 4) == 0) && need_keyboard(d, reply) == false) {
+    return;
+  }
+  if (strncmp(line, "color ", 6) == 0) {
+    int r, g, b;
+    if (sscanf(line + 6, "%d %d %d", &r, &g, &b) != 3 ||
+        r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) {
+      sbuf_appends(reply, "error invalid color\n");
+      return;
+    }
+    d->color[0] = r;
+    d->color[1] = g;
+    d->color[2] = b;
+    d->pending = COLOR;
+  } else if (strncmp(line, "frame ", 6) == 0) {
+    const char *hex = line + 6;
+    ptrdiff_t n = d->kb.rows * d->kb.cols * 3;
+    if (n == 0 || (ptrdiff_t)strlen(hex) != 2*n) {
+      sbuf_appends(reply, "error invalid frame size\n");
+      return;
+    }
+    for (ptrdiff_t k = 0; k < n; k++) {
+      int hi = hexval(hex[2*k]);
+      int lo = hexval(hex[2*k+1]);
+      if (hi < 0 || lo < 0) {
+        sbuf_appends(reply, "error invalid frame data\n");
+        return;
+      }
+      d->frame[k] = hi << 4 | lo;
+    }
+    d->pending = FRAME;
+  } else if (strncmp(line, "load ", 5) == 0) {
+    // Re-maps the profiles only if the text file has changed.
+    profiles_open(&d->profiles);
+    const Profile *prof = profiles_find(&d->profiles, line + 5);
+    if (prof == 0) {
+      sbuf_appends(reply, "error no such profile\n");
+      return;
+    }
+    if (prof->effect == PROFILE_KEYS && d->kb.rows > 0) {
+      for (int r = 0; r < d->kb.rows; r++) {
+        memcpy(d->frame + 3*d->kb.cols*r, prof->keys[r], 3*d->kb.cols);
+      }
+      d->pending = FRAME;
+    } else {
+      profile_color(prof, d->kb.product_id, d->color);
+      d->pending = COLOR;
+    }
+  } else if (strcmp(line, "load") == 0) {
+    RC_data rc;
+    read_rc(&rc);
+    if (rc.ok == false) {
+      sbuf_appends(reply, "error could not read RC file\n");
+      return;
+    }
+    d->color[0] = rc.red;
+    d->color[1] = rc.green;
+    d->color[2] = rc.blue;
+    d->pending = COLOR;
+  } else if (strcmp(line, "status") == 0) {
+    sbuf_printf(reply, "ok %d %d %d %s 0x%04x %s\n", d->clr.red, d->clr.green,
+                d->clr.blue, d->kb.gov.perkey ? "perkey" : "global",
+                d->kb.product_id,
+                d->kb.errormsg ? d->kb.errormsg : d->kb.product_name);
+    return;
+  } else {
+    sbuf_appends(reply, "error unknown command\n");
+    return;
+  }
+  sbuf_appends(reply, "ok\n");
+}
+
+// Read from a client, and execute all complete lines.
+// Returns false if the client has disconnected.
+static bool serve(Daemon *d, Client *c)
+{
+  ssize_t n = read(c->fd, c->line + c->used, IPC_LINE - 1 - c->used);
+  if (n <= 0) {
+    return false;
+  }
+  c->used += n;
+  Sbuf reply = {0};
+  char *start = c->line;
+  char *nl;
+  while ((nl = memchr(start, '\n', c->line + c->used - start)) != 0) {
+    *nl = 0;
+    execute(d, start, &reply);
+    start = nl + 1;
+  }
+  c->used -= start - c->line;
+  memmove(c->line, start, c->used);
+  if (c->used == IPC_LINE - 1) { // Line too long; discard it.
+    c->used = 0;
+    sbuf_appends(&reply, "error line too long\n");
+  }
+  bool ok = reply.used == 0 ||
+            send(c->fd, reply.data, reply.used, MSG_NOSIGNAL) == reply.used;
+  sbuf_free(&reply);
+  return ok;
+}
+
+// Send the pending color or frame if the governor allows it.
+// Returns the poll timeout in ms.
+static int flush(Daemon *d)
+{
+  if (d->pending == NONE) {
+    return -1;
+  }
+  if (d->kb.handle == 0) {
+    d->pending = NONE;
+    return -1;
+  }
+  if (usb_frame_due(&d->kb) == false) {
+    return usb_frame_wait(&d->kb);
+  }
+  if (d->pending == COLOR) {
+    if (usb_set_color(&d->kb, d->color[0], d->color[1], d->color[2])) {
+      d->clr.red = d->color[0];
+      d->clr.green = d->color[1];
+      d->clr.blue = d->color[2];
+    }
+  } else {
+    usb_set_frame(&d->kb, d->frame);
+  }
+  d->pending = NONE;
+  return -1;
+}
+
+// Create the listening socket. Returns -1 on failure.
+static int listen_socket(Sbuf *path)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (path->error || path->used >= (ptrdiff_t)sizeof(addr.sun_path)) {
+    fputs("x-razerd: socket path too long\n", stderr);
+    return -1;
+  }
+  memcpy(addr.sun_path, path->data, path->used);
+  int fd = ipc_connect();
+  if (fd >= 0) {
+    close(fd);
+    fputs("x-razerd: already running\n", stderr);
+    return -1;
+  }
+  unlink(path->data); // Remove a stale socket.
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("x-razerd: socket");
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(fd, MAXCLIENTS) != 0) {
+    perror("x-razerd: bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(void)
+{
+  static Daemon d = {0};
+  Sbuf path = {0};
+  ipc_path(&path);
+  int lfd = listen_socket(&path);
+  if (lfd < 0) {
+    sbuf_free(&path);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  usb_init(&d.kb);
+  if (d.kb.errormsg != 0) {
+    fprintf(stderr, "x-razerd: %s\n", d.kb.errormsg);
+  }
+  // A changed RC file is applied, like the “load” command.
+  rc_watch_open(&d.watch);
+  int timeout = -1;
+  while (done == 0) {
+    struct pollfd fds[MAXCLIENTS+2];
+    fds[0] = (struct pollfd) {
+      .fd = lfd, .events = POLLIN
+    };
+    for (int k = 0; k < d.nclients; k++) {
+      fds[k+1] = (struct pollfd) {
+        .fd = d.clients[k].fd, .events = POLLIN
+      };
+    }
+    // Poll ignores a negative fd.
+    int wk = d.nclients + 1;
+    fds[wk] = (struct pollfd) {
+      .fd = d.watch.fd, .events = POLLIN
+    };
+    int n = poll(fds, wk + 1, timeout);
+    if (n < 0 && errno != EINTR) {
+      perror("x-razerd: poll");
+      break;
+    }
+    // Handle all clients before sending anything, so that bursts of
+    // commands are coalesced.
+    for (int k = d.nclients - 1; n > 0 && k >= 0; k--) {
+      if (fds[k+1].revents == 0) {
+        continue;
+      }
+      if (serve(&d, &d.clients[k]) == false) {
+        close(d.clients[k].fd);
+        d.clients[k] = d.clients[--d.nclients];
+      }
+    }
+    if (n > 0 && (fds[wk].revents & POLLIN) && rc_watch_changed(&d.watch)) {
+      char load[] = "load";
+      Sbuf reply = {0};
+      execute(&d, load, &reply);
+      sbuf_free(&reply);
+    }
+    if (d.watch.error) {
+      fputs("x-razerd: stopped watching the RC file\n", stderr);
+      rc_watch_close(&d.watch);
+      d.watch.error = false;
+    }
+    if (n > 0 && (fds[0].revents & POLLIN)) {
+      int cfd = accept(lfd, 0, 0);
+      if (cfd >= 0 && d.nclients < MAXCLIENTS) {
+        d.clients[d.nclients].fd = cfd;
+        d.clients[d.nclients].used = 0;
+        d.nclients++;
+      } else if (cfd >= 0) {
+        close(cfd);
+      }
+    }
+    timeout = flush(&d);
+    METRIC_SET(queue_depth, d.pending != NONE);
+    metrics_update("x-razerd");
+    if (getenv("X_RAZER_METRICS") != 0 &&
+        (timeout < 0 || timeout > METRICS_INTERVAL * 1000)) {
+      timeout = METRICS_INTERVAL * 1000;
+    }
+  }
+  for (int k = 0; k < d.nclients; k++) {
+    close(d.clients[k].fd);
+  }
+  close(lfd);
+  unlink(path.data);
+  sbuf_free(&path);
+  rc_watch_close(&d.watch);
+  usb_close(&d.kb);
+  usb_exit();
+  profiles_close(&d.profiles);
+  if (getenv("X_RAZER_METRICS") != 0) {
+    metrics_write(getenv("X_RAZER_METRICS"), "x-razerd");
+  }
+  return 0;
+}